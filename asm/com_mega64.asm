@@ -133,6 +133,22 @@
 .equ GET_ADC6		= 0xA6
 .equ GET_ADC7		= 0xA7
 
+.equ GET_CONFIG		= 0xC0		; Send all CPLD settings in one frame
+
+;===================================================;
+; Bits of cfg_valid. Same order as the settings in  ;
+; the GET_CONFIG frame and CONF_* on the PC.        ;
+;===================================================;
+.equ CFG_N_SAMPLES	= 0
+.equ CFG_PW		= 1
+.equ CFG_DELAY	= 2
+.equ CFG_POL_PRECEDE	= 3
+.equ CFG_ADC		= 4
+.equ CFG_MODE		= 5
+.equ CFG_ATTEN22	= 6
+.equ CFG_ATTEN35	= 7
+.equ CFG_BYTES	= 13		; bytes of settings in the frame
+
 .equ FOO_CMD		= 0x7B 		; 0x7b = 123
 
 ;#############################################################################
@@ -210,6 +226,8 @@ reset:
 	out 	WDTCR, temp		; Set prescaler to 0b111
 
 	rcall	incr_reset_counter	; Increment the reset counter
+	clr	temp			; No CPLD setting written since the reset
+	sts	cfg_valid, temp
 
 	; !!! HANGS IF TWI SLAVE NOT CONNECTED OR TWI BUS BROKEN
 	rcall	init_thermostat		; Initialize the DS1621 over TWI (not yet installed)
@@ -300,6 +318,9 @@ check_usb_bits:
 	cpi	data, GET_ADC7
 	breq	jmp_get_adc7
 
+	cpi	data, GET_CONFIG
+	breq	jmp_get_config
+
 	cpi	data, FOO_CMD
 	breq	jmp_foo_cmd
 		
@@ -374,6 +395,9 @@ jmp_get_adc6:
 jmp_get_adc7:
 	rjmp	com_get_adc7
 
+jmp_get_config:
+	rjmp	com_get_config
+
 jmp_foo_cmd:
 	rjmp	com_foo_cmd
 
@@ -433,6 +457,12 @@ com_set_num_samples:
 
 	rcall	twi_stop
 
+	sts	cfg_n_samples, buffer1
+	sts	cfg_n_samples+1, buffer2
+	sts	cfg_n_samples+2, buffer3
+	ldi	temp, 1<<CFG_N_SAMPLES		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -468,12 +498,16 @@ com_set_pw:
 ;	rcall	twi_check
 
 	pop	data			; Pop PW from stack
+	sts	cfg_pw, data		; keep it for GET_CONFIG
 	rcall	twi_write		; Write it to CPLD
 	ldi	twi_stat, DAT_W_ACK	; Check status (data transmitted)
 ;	rcall	twi_check
 
 	rcall	twi_stop
 
+	ldi	temp, 1<<CFG_PW		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -525,6 +559,11 @@ com_set_delay:
 
 	rcall	twi_stop
 	
+	sts	cfg_delay, buffer1
+	sts	cfg_delay+1, buffer2
+	ldi	temp, 1<<CFG_DELAY		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -559,12 +598,16 @@ com_set_mode:
 	rcall	twi_check
 
 	pop	data			; Pop PW from stack
+	sts	cfg_mode, data		; keep it for GET_CONFIG
 	rcall	twi_write		; Write it to CPLD
 	ldi	twi_stat, DAT_W_ACK	; Check status (data transmitted)
 	rcall	twi_check
 
 	rcall	twi_stop
 
+	ldi	temp, 1<<CFG_MODE		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -1221,12 +1264,16 @@ com_set_adc:
 ;	rcall	twi_check
 
 	pop	data			; Pop delay from stack
+	sts	cfg_adc, data		; keep it for GET_CONFIG
 	rcall	twi_write		; Write it to CPLD
 	ldi	twi_stat, DAT_W_ACK	; Check status (data transmitted)
 ;	rcall	twi_check
 
 	rcall	twi_stop
 
+	ldi	temp, 1<<CFG_ADC		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -1305,12 +1352,16 @@ com_set_pol_precede:
 ;	rcall	twi_check
 
 	pop	data			; Pop pol_preced from stack
+	sts	cfg_pol_precede, data		; keep it for GET_CONFIG
 	rcall	twi_write		; Write it to CPLD
 	ldi	twi_stat, DAT_W_ACK	; Check status (data transmitted)
 ;	rcall	twi_check
 
 	rcall	twi_stop
 
+	ldi	temp, 1<<CFG_POL_PRECEDE		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -1364,6 +1415,11 @@ com_set_atten22:
 
 	rcall	twi_stop
 
+	sts	cfg_atten22, buffer1
+	sts	cfg_atten22+1, buffer2
+	ldi	temp, 1<<CFG_ATTEN22		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -1415,6 +1471,11 @@ com_set_atten35:
 
 	rcall	twi_stop
 
+	sts	cfg_atten35, buffer1
+	sts	cfg_atten35+1, buffer2
+	ldi	temp, 1<<CFG_ATTEN35		; valid until the next reset
+	rcall	cfg_mark
+
 	ldi	data, DONE		; Send done message
 	rcall	write_byte_usb
 
@@ -1531,6 +1592,31 @@ wait_adc7:
 
 	rjmp 	main
 
+;--------------------------------------------------;
+; Send the CPLD settings written since the reset.  ;
+; Frame: command, cfg_valid, CFG_BYTES settings,   ;
+; DONE. Settings without their valid bit are junk. ;
+;--------------------------------------------------;
+com_get_config:
+	rcall	write_byte_usb		; write back received command byte to PC
+
+	lds	data, cfg_valid		; which settings were written
+	rcall	write_byte_usb
+
+	ldi	ZL, low(cfg_n_samples)	; the settings follow each other in SRAM
+	ldi	ZH, high(cfg_n_samples)
+	ldi	counter, CFG_BYTES
+send_config:
+	ld	data, Z+
+	rcall	write_byte_usb
+	dec	counter
+	brne	send_config
+
+	ldi	data, DONE		; Send done message
+	rcall	write_byte_usb
+
+	rjmp	main
+
 ;------------------------------------;
 ; use this to try out some foo stuff ;
 ;------------------------------------;
@@ -1968,6 +2054,17 @@ incr_reset_counter:
 	ret
 ;=============================;
 
+;=========================================;
+; Set the bits of temp in cfg_valid       ;
+;-----------------------------------------;
+cfg_mark:
+	lds	buffer3, cfg_valid
+	or	buffer3, temp
+	sts	cfg_valid, buffer3
+
+	ret
+;=========================================;
+
 ;==========================;
 ; Switch on Watchdog timer ;
 ;--------------------------;
@@ -2085,6 +2182,25 @@ init_board_thermostat:
 	ret
 
 
+;#############################################################################
+;	        	       S R A M   D A T A
+;#############################################################################
+
+.DSEG
+
+; Last value written to the CPLD for every setting, in the order of the
+; GET_CONFIG frame. The CPLD can not be read back.
+cfg_valid:	.byte	1		; CFG_* bits of the settings written since reset
+cfg_n_samples:	.byte	3
+cfg_pw:		.byte	1
+cfg_delay:	.byte	2
+cfg_pol_precede:	.byte	1
+cfg_adc:	.byte	1
+cfg_mode:	.byte	1
+cfg_atten22:	.byte	2
+cfg_atten35:	.byte	2
+
+
 ;#############################################################################
 ;	        	      E E P R O M   D A T A
 ;#############################################################################
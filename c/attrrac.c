@@ -3,12 +3,14 @@
 #include <unistd.h>
 #include <sys/un.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "attrracd.h"
+#include "server.h"
 
 #define SERVER_ADDR "127.0.0.1"
 //////////////////////////////////////////
@@ -16,44 +18,151 @@
 // ssh -L 1234:localhost:1111 root@sbc	//
 //////////////////////////////////////////
 
+/* Read exactly len bytes */
+static int read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+	
+	while (len > 0){
+		n = read(fd, p, len);
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
 
-int main(int argc, char *argv[])
+
+/* Connect to the unix socket of the daemon. Returns -1 if it is not
+ * there, e.g. when the daemon is reached through a tunnel. */
+static int connect_unix(void)
 {
-	struct sockaddr_in strAddr;
-	socklen_t lenAddr;
-	int fdSock;
-	//char message[MAX_LENGTH];
+	struct sockaddr_un addr;
+	int fd;
 	
-	/* open socket */
-	if ((fdSock=socket(AF_INET, SOCK_STREAM, 0)) < 0){
-		printf("Could not open socket\n");
-		exit(1);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", SOCKET_PATH);
+	if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0){
+		close(fd);
+		return -1;
 	}
+	return fd;
+}
+
+static int connect_tcp(void)
+{
+	struct sockaddr_in strAddr;
+	int fd;
+	
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
 	
 	bzero(&strAddr, sizeof(strAddr));
-	inet_pton(AF_INET, SERVER_ADDR, &strAddr);
+	inet_pton(AF_INET, SERVER_ADDR, &strAddr.sin_addr);
 	/* Set inet type socket */
 	strAddr.sin_family = AF_INET;
-	strAddr.sin_port = htons(1111);
+	strAddr.sin_port = htons(SERVER_PORT);
 	
-	//strcpy(strAddr.sun_path, SOCKET_PATH);
-	//lenAddr=sizeof(strAddr.sun_family)+strlen(strAddr.sun_path);
-	lenAddr = sizeof(strAddr);
+	if (connect(fd, (struct sockaddr*)&strAddr, sizeof(strAddr)) != 0){
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/* One message: a packet on the unix socket, length and text on TCP */
+static int send_message(int fd, int packet, char *message)
+{
+	uint32_t len = htonl(strlen(message));
+	
+	if (packet)
+		return send(fd, message, strlen(message), 0) == strlen(message) ? 0 : -1;
+	if (write(fd, &len, 4) != 4
+	    || write(fd, message, strlen(message)) != strlen(message))
+		return -1;
+	return 0;
+}
+
+static int recv_message(int fd, int packet, char *message)
+{
+	uint32_t len;
+	ssize_t n;
 	
-	/* Connect to socket */
-	if (connect(fdSock, (struct sockaddr*)&strAddr, lenAddr) !=0 ){
+	if (packet){
+		n = recv(fd, message, SERVER_MAX_MSG, 0);
+		if (n <= 0)
+			return -1;
+		message[n] = '\0';
+		return 0;
+	}
+	if (read_all(fd, &len, 4) != 0 || ntohl(len) > SERVER_MAX_MSG
+	    || read_all(fd, message, ntohl(len)) != 0)
+		return -1;
+	message[ntohl(len)] = '\0';
+	return 0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int fdSock, packet = 1;
+	char message[SERVER_MAX_MSG + 1];
+	int i;
+	
+	if (argc < 2){
+		printf("Usage: %s <command> [arg1] [arg2]\n", argv[0]);
+		printf("       %s subscribe <stats|iq> [every]\n", argv[0]);
+		printf("       %s set_config <field>=<value> ...\n", argv[0]);
+		printf("       %s set_schedule <job> \"<sec> <min> <hour>\"|off\n", argv[0]);
+		exit(1);
+	}
+	
+	/* unix socket in the working directory of the daemon, else TCP */
+	if ((fdSock = connect_unix()) < 0){
+		packet = 0;
+		fdSock = connect_tcp();
+	}
+	if (fdSock < 0){
 		printf("Socket connection failed\n");
 		exit(1);
 	}
-	printf("\nConnected to Server ... sending data ...\n");
-		
-	write(fdSock, argv[1], MAX_LENGTH);
-	write(fdSock, argv[2], MAX_LENGTH);
-	write(fdSock, argv[3], MAX_LENGTH);
-	// add error checking.....
-	//	read(fdSock, message, MAX_LENGTH);
+	// stdout only gets the reply, so scripts can use the values
+	fprintf(stderr, "\nConnected to Server ... sending data ...\n");
 	
+	/* request is "<command> [arg1] [arg2] ..." */
+	message[0] = '\0';
+	for (i = 1; i < argc; i++){
+		if (i > 1)
+			strncat(message, " ", SERVER_MAX_MSG - strlen(message));
+		strncat(message, argv[i], SERVER_MAX_MSG - strlen(message));
+	}
+	if (send_message(fdSock, packet, message) != 0){
+		printf("Sending failed\n");
+		exit(1);
+	}
+	
+	/* wait for reply */
+	if (recv_message(fdSock, packet, message) != 0){
+		printf("No reply from server\n");
+		exit(1);
+	}
+	
+	/* "OK [values]" or "ERR <status>" */
+	printf("%s\n", message);
+	
+	/* after "subscribe" print the live feed until the server closes */
+	if (strcmp(argv[1], "subscribe") == 0 && strncmp(message, "OK", 2) == 0){
+		while (recv_message(fdSock, packet, message) == 0){
+			printf("%s\n", message);
+			fflush(stdout);
+		}
+	}
 	
 	close(fdSock);
-	return 0;
+	return strncmp(message, "OK", 2) == 0 ? 0 : 1;
 }
@@ -12,6 +12,7 @@
 #include <signal.h>
 #include <math.h>
 #include <pthread.h>
+#include <sys/time.h>
 
 /* for socket things */
 #include <sys/socket.h>
@@ -19,12 +20,21 @@
 #include <netinet/in.h>
 #include <sys/un.h>
 #include <string.h>
+#include <ctype.h>
 
 #include "ftd2xx.h"
 
 #include "helper.h"
 #include "attrracd.h"
 #include "usb_control.h"
+#include "data_writer.h"
+#include "outbox.h"
+#include "distrometer.h"
+#include "fusion.h"
+#include "server.h"
+#include "jobs.h"
+#include "device.h"
+#include "schedule.h"
 
 
 /* G L O B A L S */
@@ -32,7 +42,7 @@
 /* Handle for USB device */
 FT_HANDLE ftHandle;
 
-/* flag changed by SIGINT that stops the main loop if == 0 */
+/* flag that stops the main loop if == 0 (command "quit") */
 int keep_running = 1;
 
 /* Struct for all pulse generator settings */
@@ -50,429 +60,1830 @@ int keep_running = 1;
 // } pulse_conf;
 
 PULSE_CONF pulse_conf;
+#define PULSE_FIELDS	((1<<CONF_FIELDS) - 1 - (1<<CONF_LOOP_FREQ))
+
+/* Fields of pulse_conf the device has acknowledged. They are not sent
+ * again while unchanged and while the reset count of the device stays
+ * at shadow_resets, a reset brings back the power on settings. */
+static int pulse_conf_valid = 0;
+static int shadow_resets = -1;		// not read yet
+
+/* Set while a job runs with its own configuration, the slow loop is
+ * paused and gets its configuration back afterwards. Other requests
+ * can not change the configuration meanwhile, they get CPLD_BUSY. */
+static int job_config_active = 0;
+
+/* Settings of the jobs that are changed by the control server while a
+ * job may read them on the worker: the config of the job commands, the
+ * file formats and the parameters of the radar jobs */
+static pthread_mutex_t job_settings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Format of the files written by "start" (IQ_FORMAT_TEXT | IQ_FORMAT_BINARY) */
+int burst_format = IQ_FORMAT_TEXT;
+
+/* Format of the range profiles written by "radar" */
+int radar_format = IQ_FORMAT_TEXT;
+
+/* How the samples of a range gate are averaged (RP_INCOHERENT ...) */
+int radar_integration = RP_INCOHERENT;
+
+/* The settings above and those of the radar jobs as a job sees them.
+ * They are taken once when the job starts, a change during the job
+ * applies to the next one. conf is pulse_conf with the fields of the
+ * job applied, the worker never reads pulse_conf itself. */
+struct job_settings{
+	PULSE_CONF	conf;
+	int	burst_format;
+	int	radar_format;
+	int	integration;		// of the radar jobs
+	int	adaptive_samples;
+	double	adaptive_sigma;
+	int	clutter_mode;
+	double	clutter_alpha;
+};
+
+/* When the slow loop starts a new file. Default is one file per minute */
+ROTATE_POLICY loop_rotation = {ROTATE_TIME, 60, 0};
+
+/* Distrometer files are started every 10 minutes */
+ROTATE_POLICY distro_rotation = {ROTATE_TIME, 600, 0};
+
+/* Disk quota of OUTBOX_DIR in bytes, enforced by the outbox thread */
+long outbox_quota = OUTBOX_QUOTA;
+
+/* Settings of set_default. The config file starts from them as well. */
+static const PULSE_CONF default_conf = {
+	.n_samples = 512, .pw = 10, .delay = 222, .pol_preced = 0,
+	.adc_delay = 1, .mode = COPOL,
+	.atten22_1 = 0, .atten22_2 = 0, .atten35_1 = 0, .atten35_2 = 0
+};
 
 /* F U N C T I O N S */
 
-/* Function getting called by signal handler when receiving SIGINT */
-void terminate()
+/* Names of the configuration fields, in the order of CONF_* */
+static char *conf_names[CONF_FIELDS] = {
+	"n_samples", "pw", "delay", "pol_precede", "adc_delay", "mode",
+	"atten22", "atten35", "loop_freq"
+};
+
+/* A complete configuration applied in one transaction */
+struct config_batch{
+	PULSE_CONF	conf;
+	int		loop_freq;
+	int		mask;			// fields to set
+	int		results[CONF_FIELDS];
+	int		job;			// sent by the running job
+};
+
+static char *status_name(int status)
+{
+	switch (status){
+	case OK:		return "OK";
+	case CPLD_BUSY:		return "BUSY";
+	case USB_ERR:		return "USB_ERR";
+	case uC_ERR:		return "UC_ERR";
+	case ARG_ERR:		return "ARG_ERR";
+	case CONF_NOT_SENT:	return "NOT_SENT";
+	case CONF_UNKNOWN:	return "UNKNOWN";
+	default:		return "ERR";
+	}
+}
+
+/* Parse the value of configuration field f into batch. The attenuators
+ * take "<atten1>,<atten2>". */
+static int parse_conf_value(int f, char *value, struct config_batch *b)
+{
+	switch (f){
+	case CONF_N_SAMPLES:	b->conf.n_samples = atoi(value); break;
+	case CONF_PW:		b->conf.pw = atoi(value); break;
+	case CONF_DELAY:	b->conf.delay = atoi(value); break;
+	case CONF_POL_PRECEDE:	b->conf.pol_preced = atoi(value); break;
+	case CONF_ADC_DELAY:	b->conf.adc_delay = atoi(value); break;
+	case CONF_LOOP_FREQ:	b->loop_freq = atoi(value); break;
+	case CONF_MODE:
+		if (strcmp(value, "CROSSPOL") == 0)		b->conf.mode = CROSSPOL;
+		else if (strcmp(value, "COPOL") == 0)		b->conf.mode = COPOL;
+		else if (strcmp(value, "RADIOMETER") == 0)	b->conf.mode = RADIOMETER;
+		else if (strcmp(value, "CALIBRATE") == 0)	b->conf.mode = CALIBRATE;
+		else{
+			syslog (LOG_NOTICE, "Unknown mode.\n");
+			return ARG_ERR;
+		}
+		break;
+	case CONF_ATTEN22:
+		if (sscanf(value, "%d,%d", &b->conf.atten22_1, &b->conf.atten22_2) != 2)
+			return ARG_ERR;
+		break;
+	case CONF_ATTEN35:
+		if (sscanf(value, "%d,%d", &b->conf.atten35_1, &b->conf.atten35_2) != 2)
+			return ARG_ERR;
+		break;
+	default:
+		return ARG_ERR;
+	}
+	b->mask |= 1<<f;
+	return OK;
+}
+
+/* Parse one "<field>=<value>" of a configuration into batch */
+static int parse_conf_field(char *pair, struct config_batch *b)
+{
+	char *value = strchr(pair, '=');
+	int f;
+
+	if (value == NULL)
+		return ARG_ERR;
+	*value++ = '\0';
+	for (f = 0; f < CONF_FIELDS; f++)
+		if (strcmp(pair, conf_names[f]) == 0)
+			return parse_conf_value(f, value, b);
+
+	syslog(LOG_NOTICE, "Unknown configuration field %s\n", pair);
+	return ARG_ERR;
+}
+
+/* Fields of a that differ from pulse_conf */
+static int changed_fields(PULSE_CONF *a)
+{
+	PULSE_CONF *p = &pulse_conf;
+	int mask = 0;
+
+	if (a->n_samples != p->n_samples)	mask |= 1<<CONF_N_SAMPLES;
+	if (a->pw != p->pw)			mask |= 1<<CONF_PW;
+	if (a->delay != p->delay)		mask |= 1<<CONF_DELAY;
+	if (a->pol_preced != p->pol_preced)	mask |= 1<<CONF_POL_PRECEDE;
+	if (a->adc_delay != p->adc_delay)	mask |= 1<<CONF_ADC_DELAY;
+	if (a->mode != p->mode)			mask |= 1<<CONF_MODE;
+	if (a->atten22_1 != p->atten22_1 || a->atten22_2 != p->atten22_2)
+		mask |= 1<<CONF_ATTEN22;
+	if (a->atten35_1 != p->atten35_1 || a->atten35_2 != p->atten35_2)
+		mask |= 1<<CONF_ATTEN35;
+	return mask;
+}
+
+/* Forget what the device has acknowledged if it was reset since, or if
+ * the reset count can not be read. What the device still has is read
+ * back with GET_CONFIG, this also picks up the state after a restart of
+ * the daemon. */
+static void check_resets(FT_HANDLE ftHandle)
+{
+	PULSE_CONF conf = pulse_conf;
+	int resets, valid;
+
+	if (get_reset_count(ftHandle, &resets) != OK)
+		resets = -1;
+	if (resets == shadow_resets && resets >= 0)
+		return;
+	if (pulse_conf_valid != 0)
+		syslog(LOG_NOTICE, "Device reset, configuration is sent again\n");
+	pulse_conf_valid = 0;
+	shadow_resets = resets;
+
+	if (resets >= 0 && get_pulse_conf(ftHandle, &conf, &valid) == OK){
+		pulse_conf = conf;
+		pulse_conf_valid = valid & PULSE_FIELDS;
+	}
+}
+
+/* Runs on the owner thread of the device. pulse_conf keeps what the
+ * device has taken, fields it already has are not sent. */
+static int apply_config(FT_HANDLE ftHandle, struct config_batch *b)
+{
+	int status = OK, f, unchanged;
+
+	for (f = 0; f < CONF_FIELDS; f++)
+		b->results[f] = CONF_NOT_SENT;
+
+	status = check_pulse_conf(&b->conf, b->loop_freq, b->mask);
+	if (status != OK)
+		return status;
+
+	// the end of the job would take back the change of another client
+	if (b->mask & PULSE_FIELDS && job_config_active && !b->job){
+		syslog(LOG_NOTICE, "Configuration can not change while a job runs\n");
+		for (f = 0; f < CONF_FIELDS; f++)
+			if (b->mask & 1<<f)
+				b->results[f] = CPLD_BUSY;
+		return CPLD_BUSY;
+	}
+
+	// the slow loop reads records of its n_samples
+	if (b->mask & 1<<CONF_N_SAMPLES && slow_loop_keep_running == 1
+	    && !b->job && b->conf.n_samples != pulse_conf.n_samples){
+		syslog(LOG_NOTICE, "n_samples can not change while the slow loop runs\n");
+		return ARG_ERR;
+	}
+
+	// The reset count is only read if it saves writes, or once to
+	// start with. The loop frequency has no reply and is always sent.
+	unchanged = b->mask & pulse_conf_valid & ~changed_fields(&b->conf);
+	if (unchanged != 0 || shadow_resets < 0){
+		check_resets(ftHandle);
+		unchanged &= pulse_conf_valid;
+	}
+
+	if (b->mask & ~unchanged)
+		status = set_pulse_conf(ftHandle, &b->conf, b->loop_freq,
+					b->mask & ~unchanged, b->results);
+	for (f = 0; f < CONF_FIELDS; f++){
+		if (unchanged & 1<<f)
+			b->results[f] = OK;
+		else if (b->mask & 1<<f && b->results[f] == OK)
+			pulse_conf_valid |= 1<<f & PULSE_FIELDS;
+		else if (b->mask & 1<<f)
+			// busy or unknown, the device may have any value now
+			pulse_conf_valid &= ~(1<<f);
+	}
+
+	if (b->results[CONF_N_SAMPLES] == OK)
+		pulse_conf.n_samples = b->conf.n_samples;
+	if (b->results[CONF_PW] == OK)
+		pulse_conf.pw = b->conf.pw;
+	if (b->results[CONF_DELAY] == OK)
+		pulse_conf.delay = b->conf.delay;
+	if (b->results[CONF_POL_PRECEDE] == OK)
+		pulse_conf.pol_preced = b->conf.pol_preced;
+	if (b->results[CONF_ADC_DELAY] == OK)
+		pulse_conf.adc_delay = b->conf.adc_delay;
+	if (b->results[CONF_MODE] == OK)
+		pulse_conf.mode = b->conf.mode;
+	if (b->results[CONF_ATTEN22] == OK){
+		pulse_conf.atten22_1 = b->conf.atten22_1;
+		pulse_conf.atten22_2 = b->conf.atten22_2;
+	}
+	if (b->results[CONF_ATTEN35] == OK){
+		pulse_conf.atten35_1 = b->conf.atten35_1;
+		pulse_conf.atten35_2 = b->conf.atten35_2;
+	}
+	return status;
+}
+
+/* All fields of default_conf in one transaction */
+int set_default(FT_HANDLE ftHandle)
+{
+	struct config_batch b;
+
+	memset(&b, 0, sizeof(b));
+	b.conf = default_conf;
+	b.mask = PULSE_FIELDS;
+	return apply_config(ftHandle, &b);
+}
+
+
+/* One burst, run on the owner thread of the device */
+struct measurement{
+	int		delay;		// set before the burst if > 0
+	int		n_bytes;
+	DATA_STRUCT	*data;
+	unsigned char	*raw;		// n_bytes read buffer, NULL to allocate one
+};
+
+static int measure(FT_HANDLE ftHandle, void *arg)
+{
+	struct measurement *m = (struct measurement*) arg;
+	struct config_batch b;
+	int status;
+	
+	if (m->delay > 0){
+		memset(&b, 0, sizeof(b));
+		b.conf = pulse_conf;
+		b.conf.delay = m->delay;
+		b.mask = 1<<CONF_DELAY;
+		b.job = 1;
+		status = apply_config(ftHandle, &b);
+		// the delay the burst would really be measured at
+		m->delay = pulse_conf.delay;
+		if (status != OK){
+			syslog(LOG_ERR, "measure: delay %d not set, error %d\n",
+			       b.conf.delay, status);
+			return status;
+		}
+	}
+	
+	// Start measurement and read data
+	if (m->raw != NULL)
+		status = start_msrmnt_buf(ftHandle, m->n_bytes, m->data, m->raw);
+	else
+		status = start_msrmnt(ftHandle, m->n_bytes, m->data);
+	if (status != OK || m->data->N != m->n_bytes/18)
+		FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+	return status;
+}
+
+/* Job "start": read a burst of n_samples and write it to a timestamped
+ * file. Runs on the job worker. */
+int read_burst(JOB *job, struct job_settings *s)
+{
+	int status = OK;
+	int N = s->conf.n_samples/2;			// n/2 samples per polarization
+	int n_bytes_to_read = 9*s->conf.n_samples; 	// 9 bytes data per polarization
+	
+	DATA_STRUCT *data = create_data_struct(N);
+	struct measurement m = {0, n_bytes_to_read, data, NULL};
+	
+	struct timeval tim;
+	struct tm *ts;
+	char filename[23];
+	
+	int max_tries = 3;
+	int tries = 0;
+	int retry = 0;
+	
+	// read burst and retry if it fails
+	for(tries=0; tries<max_tries; tries++)
+	{
+		if (job->cancel) break;
+		syslog(LOG_NOTICE, "n_of_tries %d\n", tries);
+	 
+		retry = 0;
+ 
+		// Start measurement and read data
+		status = device_call(measure, &m);
+		if (status != OK){
+			syslog(LOG_ERR, "start_msrmnt: error %d\n", status);
+			retry = 1;
+		}
+	  
+		// check if number of bytes read is OK
+		if(data->N != s->conf.n_samples/2){
+			syslog(LOG_ERR, "n_bytes_read wrong\n");
+			retry = 1;
+		}
+		
+		// if no retry is needed
+		if (retry == 0){
+			// write file with timestamped filename
+			gettimeofday(&tim, NULL);
+			ts = gmtime(&tim.tv_sec);
+			if (s->burst_format == IQ_FORMAT_BINARY)
+				strftime(filename, 23, "iq_%Y%m%d_%H%M%S.bin", ts);
+			else
+				strftime(filename, 23, "iq_%Y%m%d_%H%M%S.dat", ts);
+			status = write_iq_burst(filename, data, &s->conf,
+						&tim, s->burst_format);
+			// move file to the outbox
+			if (status == OK)
+				status = publish_file(filename);
+			if (status == OK)
+				snprintf(job->result, JOB_RESULT_SIZE, "%s", filename);
+			// exit loop, because nomore try is needed
+			break;
+		}
+	}
+	if (tries == max_tries) status = ERR;
+	free_data_struct(data);
+	return status;
+}
+
+/* A range gate of the radar sweep. Two of them take turns, the owner
+ * thread measures the next gate while the worker reduces this one. */
+struct sweep_gate{
+	struct measurement	m;
+	DEVICE_WAIT		w;
+};
+
+/* Mean and standard deviation of the gate into the range profile, and
+ * the coherent mean of each receiver unless integration is incoherent */
+static void reduce_gate(struct measurement *m, int integration, RP_GATE *g)
+{
+	DATA_STRUCT *d = m->data;
+	DATA_POINTS *ch[RP_CHANNELS] = {d->h_a_35, d->h_p_35, d->h_a_22, d->h_p_22,
+					d->v_a_35, d->v_p_35, d->v_a_22, d->v_p_22};
+	DATA_POINTS *iq[2*RP_RECEIVERS] = {d->h_i_35, d->h_q_35, d->h_i_22, d->h_q_22,
+					   d->v_i_35, d->v_q_35, d->v_i_22, d->v_q_22};
+	double amplitude, phase, snr;
+	int c;
+
+	mean(d, SKIP);
+	std_dev(d, SKIP);
+	g->delay = m->delay;
+	g->N = d->N;
+	for (c = 0; c < RP_CHANNELS; c++){
+		g->mean[c] = ch[c]->mean;
+		g->std_dev[c] = ch[c]->std_dev;
+	}
+	for (c = 0; c < RP_RECEIVERS; c++){
+		amplitude = phase = snr = 0;
+		if (integration != RP_INCOHERENT)
+			coherent_mean(iq[2*c], iq[2*c+1], d->N, SKIP,
+				      integration == RP_COHERENT_DRIFT,
+				      &amplitude, &phase, &snr);
+		g->coh_amp[c] = amplitude;
+		g->coh_phase[c] = phase;
+		g->snr[c] = snr;
+	}
+}
+
+static int run_config(FT_HANDLE ftHandle, void *arg)
+{
+	return apply_config(ftHandle, (struct config_batch*) arg);
+}
+
+/* Runs on the owner thread. n_samples of the gates of a sweep. */
+static int set_sweep_samples(FT_HANDLE ftHandle, void *arg)
+{
+	struct config_batch b;
+
+	if (*(int*) arg == pulse_conf.n_samples)
+		return OK;
+	memset(&b, 0, sizeof(b));
+	b.conf = pulse_conf;
+	b.conf.n_samples = *(int*) arg;
+	b.mask = 1<<CONF_N_SAMPLES;
+	b.job = 1;
+	return apply_config(ftHandle, &b);
+}
+
+/* Measure the gates at delays[0..n_gates-1] with n_samples each into
+ * gates. The next gate is queued on the device before the last one is
+ * reduced, the buffers of the two gates are used for the whole sweep.
+ * n_done counts the gates measured, they are kept on cancel or error. */
+static int sweep_gates(JOB *job, int *delays, int n_gates, int n_samples,
+		       int integration, RP_GATE *gates, int *n_done)
+{
+	int status = OK;
+	int n_bytes_to_read = 9*n_samples;
+	int in_flight, k;
+	struct sweep_gate gate[2], *g, *next;
+	
+	*n_done = 0;
+	if (n_gates <= 0)
+		return OK;
+	if ((status = device_call(set_sweep_samples, &n_samples)) != OK)
+		return status;
+	
+	for (k = 0; k < 2; k++){
+		gate[k].m.n_bytes = n_bytes_to_read;
+		gate[k].m.data = create_data_struct(n_samples/2);
+		gate[k].m.raw = malloc(n_bytes_to_read);
+	}
+	
+	gate[0].m.delay = delays[0];
+	in_flight = device_start(measure, &gate[0].m, &gate[0].w) == OK;
+	for (k = 0; in_flight; k++){
+		g = &gate[k % 2];
+		next = &gate[(k + 1) % 2];
+		status = device_wait(&g->w);
+		in_flight = 0;
+		if (status != OK){
+			syslog(LOG_ERR, "radar: gate %d error %d\n", g->m.delay, status);
+			break;
+		}
+		
+		// other requests are served between two gates
+		if (k + 1 < n_gates && !job->cancel){
+			next->m.delay = delays[k + 1];
+			status = device_start(measure, &next->m, &next->w);
+			in_flight = status == OK;
+		}
+		
+		reduce_gate(&g->m, integration, &gates[(*n_done)++]);
+	}
+	
+	for (k = 0; k < 2; k++){
+		free_data_struct(gate[k].m.data);
+		free(gate[k].m.raw);
+	}
+	return status;
+}
+
+/* Delays of all range gates for pulse width pw */
+static int sweep_delays(int pw, int *delays)
+{
+	int delay, n = 0;
+
+	for (delay = pw + 6; delay < 235 && n < RP_MAX_GATES; delay += 2)
+		delays[n++] = delay;
+	return n;
+}
+
+/* Write the profile to a timestamped file and move it to the outbox */
+static int write_sweep(JOB *job, struct job_settings *s, RANGE_PROFILE *rp)
+{
+	struct tm *ts = gmtime(&rp->tim.tv_sec);
+	char filename[27];
+	
+	if (s->radar_format == IQ_FORMAT_BINARY)
+		strftime(filename, 27, "radar_%Y%m%d_%H%M_%S.bin", ts);
+	else
+		strftime(filename, 27, "radar_%Y%m%d_%H%M_%S.dat", ts);
+	if (write_range_profile(filename, rp, s->radar_format) != OK
+	    || publish_file(filename) != OK)
+		return ERR;
+	snprintf(job->result, JOB_RESULT_SIZE, "%s", filename);
+	return OK;
+}
+
+/* Clutter map of the radar jobs. With clutter_mode other than
+ * CLUTTER_OFF the map is subtracted from the coherent means of each
+ * sweep and only the residual is written. HOLD keeps the map as it is,
+ * AUTO merges the gates without an echo above clutter_sigma into it,
+ * CLEAR merges all gates (clear air known from outside) and is the only
+ * mode that starts a map. clutter_mode and clutter_alpha are guarded by
+ * job_settings_lock, a job uses them from its struct job_settings. The
+ * worker changes clutter_map and clutter_events under the lock as well,
+ * get_clutter reads them on the server thread. */
+#define CLUTTER_OFF		0
+#define CLUTTER_HOLD		1
+#define CLUTTER_AUTO		2
+#define CLUTTER_CLEAR		3
+#define CLUTTER_SNAPSHOT_SWEEPS	60	// sweeps between two snapshots of the map
+
+static const char *clutter_modes[] = {"OFF", "HOLD", "AUTO", "CLEAR"};
+static int clutter_mode = CLUTTER_OFF;
+static double clutter_alpha = 0.05;
+static double clutter_sigma = 3.0;
+static CLUTTER_MAP clutter_map;
+static long clutter_sweeps;		// since the last snapshot
+static long clutter_events;		// gates with an echo above the map
+
+/* Noise power in the coherent mean of receiver r, from its SNR */
+static double coherent_noise(RP_GATE *g, int r)
+{
+	return g->coh_amp[r]*g->coh_amp[r] / pow(10, g->snr[r]/10);
+}
+
+/* Integration of the radar jobs, the clutter map needs coherent means */
+static int sweep_integration(struct job_settings *s)
+{
+	if (s->clutter_mode != CLUTTER_OFF && s->integration == RP_INCOHERENT)
+		return RP_COHERENT;
+	return s->integration;
+}
+
+/* 1 if the map was taken with the gates and configuration of rp */
+static int clutter_map_fits(CLUTTER_MAP *cm, RANGE_PROFILE *rp)
+{
+	int i;
+
+	if (cm->n_gates != rp->n_gates
+	    || cm->conf.pw != rp->conf.pw
+	    || cm->conf.mode != rp->conf.mode
+	    || cm->conf.pol_preced != rp->conf.pol_preced
+	    || cm->conf.adc_delay != rp->conf.adc_delay
+	    || cm->conf.atten22_1 != rp->conf.atten22_1
+	    || cm->conf.atten22_2 != rp->conf.atten22_2
+	    || cm->conf.atten35_1 != rp->conf.atten35_1
+	    || cm->conf.atten35_2 != rp->conf.atten35_2)
+		return 0;
+	for (i = 0; i < rp->n_gates; i++)
+		if (cm->delay[i] != rp->gate[i].delay)
+			return 0;
+	return 1;
+}
+
+/* Write a snapshot of the map to a timestamped file and move it to the
+ * outbox */
+static void write_clutter_snapshot(CLUTTER_MAP *cm, time_t t, int format)
+{
+	struct tm *ts = gmtime(&t);
+	char filename[29];
+
+	if (format == IQ_FORMAT_BINARY)
+		strftime(filename, 29, "clutter_%Y%m%d_%H%M_%S.bin", ts);
+	else
+		strftime(filename, 29, "clutter_%Y%m%d_%H%M_%S.dat", ts);
+	if (write_clutter_map(filename, cm, t, format) != OK
+	    || publish_file(filename) != OK)
+		syslog(LOG_ERR, "clutter: could not write %s\n", filename);
+}
+
+/* Replace the coherent means of rp by their residual against the clutter
+ * map and merge the clear gates into the map. Only a complete sweep in
+ * CLEAR mode starts a new map from itself, until then HOLD and AUTO
+ * leave the profile as it is. */
+static void clutter_apply(struct job_settings *s, RANGE_PROFILE *rp,
+			  int complete)
+{
+	CLUTTER_MAP *cm = &clutter_map;
+	RP_GATE *g;
+	double re[RP_RECEIVERS], im[RP_RECEIVERS], noise[RP_RECEIVERS];
+	double dre, dim, power, alpha = s->clutter_alpha;
+	int i, c, quiet, events = 0, mode = s->clutter_mode;
+
+	if (mode == CLUTTER_OFF || rp->integration == RP_INCOHERENT)
+		return;
+	pthread_mutex_lock(&job_settings_lock);
+	if (!clutter_map_fits(cm, rp)){
+		// an echo in the first sweep would never leave an AUTO map
+		if (!complete || rp->n_gates == 0 || mode != CLUTTER_CLEAR){
+			pthread_mutex_unlock(&job_settings_lock);
+			return;
+		}
+		memset(cm, 0, sizeof(*cm));
+		cm->conf = rp->conf;
+		cm->n_gates = rp->n_gates;
+		for (i = 0; i < rp->n_gates; i++){
+			g = &rp->gate[i];
+			cm->delay[i] = g->delay;
+			for (c = 0; c < RP_RECEIVERS; c++){
+				cm->re[i][c] = g->coh_amp[c]*cos(g->coh_phase[c]*M_PI/180);
+				cm->im[i][c] = g->coh_amp[c]*sin(g->coh_phase[c]*M_PI/180);
+			}
+		}
+		clutter_sweeps = CLUTTER_SNAPSHOT_SWEEPS;	// snapshot right away
+		syslog(LOG_NOTICE, "clutter: new map of %d gates\n", cm->n_gates);
+	}
+	cm->alpha = alpha;
+
+	for (i = 0; i < rp->n_gates; i++){
+		g = &rp->gate[i];
+		quiet = 1;
+		for (c = 0; c < RP_RECEIVERS; c++){
+			re[c] = g->coh_amp[c]*cos(g->coh_phase[c]*M_PI/180);
+			im[c] = g->coh_amp[c]*sin(g->coh_phase[c]*M_PI/180);
+			noise[c] = coherent_noise(g, c);
+			dre = re[c] - cm->re[i][c];
+			dim = im[c] - cm->im[i][c];
+			power = dre*dre + dim*dim;
+			if (power > clutter_sigma*clutter_sigma*noise[c])
+				quiet = 0;
+
+			g->coh_amp[c] = sqrt(power);
+			g->coh_phase[c] = atan2(dim, dre)*180/M_PI;
+			if (g->coh_phase[c] < 0)
+				g->coh_phase[c] += 360;
+			if (noise[c] <= 0)
+				g->snr[c] = 99.9;
+			else if (power <= 0)
+				g->snr[c] = -99.9;
+			else
+				g->snr[c] = fmax(-99.9, fmin(99.9, 10*log10(power/noise[c])));
+		}
+		if (!quiet)
+			events++;
+		if (mode == CLUTTER_CLEAR || (mode == CLUTTER_AUTO && quiet))
+			for (c = 0; c < RP_RECEIVERS; c++){
+				cm->re[i][c] += alpha*(re[c] - cm->re[i][c]);
+				cm->im[i][c] += alpha*(im[c] - cm->im[i][c]);
+			}
+	}
+	rp->residual = 1;
+	if (mode != CLUTTER_HOLD)
+		cm->updates++;
+	clutter_events += events;
+	pthread_mutex_unlock(&job_settings_lock);
+	if (events > 0)
+		syslog(LOG_NOTICE, "clutter: echo in %d of %d gates\n",
+		       events, rp->n_gates);
+
+	if (++clutter_sweeps >= CLUTTER_SNAPSHOT_SWEEPS){
+		write_clutter_snapshot(cm, rp->tim.tv_sec, s->radar_format);
+		clutter_sweeps = 0;
+	}
+}
+
+/* Job "radar": sweep the delay over all range gates and write the
+ * profile to a timestamped file. Runs on the job worker. */
+int radar_sweep(JOB *job, struct job_settings *s)
+{
+	int delays[RP_MAX_GATES];
+	int n_gates, status;
+	RANGE_PROFILE *rp = malloc(sizeof(RANGE_PROFILE));
+	
+	if (rp == NULL)
+		return ERR;
+	gettimeofday(&rp->tim, NULL);
+	rp->conf = s->conf;
+	rp->integration = sweep_integration(s);
+	rp->residual = 0;
+	n_gates = sweep_delays(s->conf.pw, delays);
+	status = sweep_gates(job, delays, n_gates, s->conf.n_samples,
+			     rp->integration, rp->gate, &rp->n_gates);
+	clutter_apply(s, rp, status == OK && rp->n_gates == n_gates);
+	if (write_sweep(job, s, rp) != OK)
+		status = ERR;
+	free(rp);
+	return status;
+}
+
+/* Adaptive sweep: a coarse pass over all gates with adaptive_samples,
+ * then a fine pass with the full n_samples over the gates whose
+ * amplitude is more than adaptive_sigma standard errors away from the
+ * baseline. The baseline is an average of the coarse passes. A gate
+ * without change goes in with weight ADAPTIVE_ALPHA, a changed one with
+ * a tenth of it, so that an echo stays refined for as long as it lasts
+ * and only a permanent change is learned. Without a baseline every gate
+ * is refined. adaptive_samples and adaptive_sigma are guarded by
+ * job_settings_lock, a job uses them from its struct job_settings. */
+#define ADAPTIVE_ALPHA		0.05
+
+static int adaptive_samples = 64;
+static double adaptive_sigma = 3.0;
+
+static struct{
+	int	n_gates;		// 0 without a baseline
+	int	integration;
+	int	delay[RP_MAX_GATES];
+	double	amp[RP_MAX_GATES][RP_RECEIVERS];
+	double	var[RP_MAX_GATES][RP_RECEIVERS];	// of amp
+} adaptive_baseline;
+
+/* Amplitude of receiver r of gate g and its variance. With coherent
+ * integration the amplitude of the coherent mean is used. */
+static void gate_amplitude(RP_GATE *g, int integration, int r,
+			   double *amp, double *var)
+{
+	static const int ch[RP_RECEIVERS] = {0, 2, 4, 6};	// the *_A channels
+
+	if (integration != RP_INCOHERENT){
+		*amp = g->coh_amp[r];
+		*var = coherent_noise(g, r);
+	}
+	else{
+		*amp = g->mean[ch[r]];
+		*var = g->std_dev[ch[r]]*g->std_dev[ch[r]]/g->N;
+	}
+}
+
+/* 1 if an amplitude of gate g differs from gate i of the baseline */
+static int gate_changed(RP_GATE *g, int i, int integration, double sigma)
+{
+	double amp, var;
+	int r;
+
+	if (g->N <= 0)
+		return 1;
+	for (r = 0; r < RP_RECEIVERS; r++){
+		gate_amplitude(g, integration, r, &amp, &var);
+		if (fabs(amp - adaptive_baseline.amp[i][r])
+		    > sigma*sqrt(var + adaptive_baseline.var[i][r]))
+			return 1;
+	}
+	return 0;
+}
+
+/* Merge a complete coarse pass into the baseline, changed[i] tells if
+ * gate i moved. A pass with other gates starts a new baseline. */
+static void update_baseline(RANGE_PROFILE *rp, int *changed, int fits)
+{
+	double amp, var, alpha;
+	int i, r;
+
+	for (i = 0; i < rp->n_gates; i++){
+		alpha = !fits ? 1 : changed[i] ? ADAPTIVE_ALPHA/10 : ADAPTIVE_ALPHA;
+		if (rp->gate[i].N <= 0)
+			alpha = 0;
+		adaptive_baseline.delay[i] = rp->gate[i].delay;
+		for (r = 0; r < RP_RECEIVERS; r++){
+			gate_amplitude(&rp->gate[i], rp->integration, r, &amp, &var);
+			adaptive_baseline.amp[i][r] += alpha*(amp - adaptive_baseline.amp[i][r]);
+			adaptive_baseline.var[i][r] += alpha*(var - adaptive_baseline.var[i][r]);
+		}
+	}
+	adaptive_baseline.n_gates = rp->n_gates;
+	adaptive_baseline.integration = rp->integration;
+}
+
+/* Job "radar_adaptive": the profile holds the fine gates and the coarse
+ * ones elsewhere, N tells them apart. Runs on the job worker. */
+int radar_adaptive(JOB *job, struct job_settings *s)
+{
+	int delays[RP_MAX_GATES], fine[RP_MAX_GATES], index[RP_MAX_GATES];
+	int changed[RP_MAX_GATES];
+	int n_gates, n_fine = 0, n_done, status, i;
+	int have_baseline;
+	RANGE_PROFILE *rp = malloc(sizeof(RANGE_PROFILE));
+	RP_GATE *fine_gates = malloc(RP_MAX_GATES*sizeof(RP_GATE));
+	
+	if (rp == NULL || fine_gates == NULL){
+		free(rp);
+		free(fine_gates);
+		return ERR;
+	}
+	gettimeofday(&rp->tim, NULL);
+	rp->conf = s->conf;
+	rp->integration = sweep_integration(s);
+	rp->residual = 0;
+	n_gates = sweep_delays(s->conf.pw, delays);
+	
+	status = sweep_gates(job, delays, n_gates, s->adaptive_samples,
+			     rp->integration, rp->gate, &rp->n_gates);
+	
+	// the baseline only fits if it has the same gates
+	have_baseline = adaptive_baseline.n_gates == rp->n_gates
+			&& adaptive_baseline.integration == rp->integration;
+	for (i = 0; i < rp->n_gates && have_baseline; i++)
+		have_baseline = adaptive_baseline.delay[i] == rp->gate[i].delay;
+	for (i = 0; i < rp->n_gates; i++){
+		changed[i] = !have_baseline
+			     || gate_changed(&rp->gate[i], i, rp->integration,
+					     s->adaptive_sigma);
+		if (changed[i]){
+			index[n_fine] = i;
+			fine[n_fine++] = rp->gate[i].delay;
+		}
+	}
+	if (status == OK && rp->n_gates == n_gates)
+		update_baseline(rp, changed, have_baseline);
+	
+	if (status == OK && !job->cancel){
+		status = sweep_gates(job, fine, n_fine, rp->conf.n_samples,
+				     rp->integration, fine_gates, &n_done);
+		for (i = 0; i < n_done; i++)
+			rp->gate[index[i]] = fine_gates[i];
+	}
+	syslog(LOG_NOTICE, "radar_adaptive: %d of %d gates refined\n",
+	       n_fine, rp->n_gates);
+	
+	// the map is only merged from a sweep that was refined completely
+	clutter_apply(s, rp, status == OK && rp->n_gates == n_gates && !job->cancel);
+	if (write_sweep(job, s, rp) != OK)
+		status = ERR;
+	free(fine_gates);
+	free(rp);
+	return status;
+}
+
+/* The slow loops run on the owner thread of the device until
+ * stop_slow_loop and serve the other requests between their records */
+static int run_slow_loop(FT_HANDLE ftHandle, void *args)
+{
+	start_slow_loop(args);
+	return OK;
+}
+
+static int run_slow_loop_calibrate(FT_HANDLE ftHandle, void *args)
+{
+	start_slow_loop_calibrate(args);
+	return OK;
+}
+
+/* Read all housekeeping values as "name=value" pairs */
+int get_housekeeping(char *result, int result_size)
+{
+	double case_temp, board_temp, adc[4];
+	int lock, cpld_status, resets;
+	int status;
+	
+	if ((status = get_case_temp(ftHandle, &case_temp)) != OK) return status;
+	if ((status = get_board_temp(ftHandle, &board_temp)) != OK) return status;
+	if ((status = get_status(ftHandle, &cpld_status)) != OK) return status;
+	if ((status = get_lock(ftHandle, &lock)) != OK) return status;
+	if ((status = get_adc4(ftHandle, &adc[0])) != OK) return status;
+	if ((status = get_adc5(ftHandle, &adc[1])) != OK) return status;
+	if ((status = get_adc6(ftHandle, &adc[2])) != OK) return status;
+	if ((status = get_adc7(ftHandle, &adc[3])) != OK) return status;
+	if ((status = get_reset_count(ftHandle, &resets)) != OK) return status;
+	
+	snprintf(result, result_size, "case_temp=%.1f board_temp=%.1f "
+		 "status=%d lock=%d adc4=%.4f adc5=%.4f adc6=%.4f adc7=%.4f "
+		 "resets=%d", case_temp, board_temp, cpld_status, lock,
+		 adc[0], adc[1], adc[2], adc[3], resets);
+	return OK;
+}
+
+/* C O M M A N D S */
+
+/* A request of the control server, split up for the command handler */
+typedef struct{
+	char		*arg[2];	// first two arguments, "" if not given
+	char		*rest;		// everything after the command name
+	char		*result;	// value returned to the client
+	int		result_size;
+	const struct command *cmd;
+} REQUEST;
+
+/* Device functions called by the generic handlers */
+typedef union{
+	int	(*run)(FT_HANDLE ftHandle);
+	int	(*set_int)(FT_HANDLE ftHandle, int value);
+	int	(*get_int)(FT_HANDLE ftHandle, int *value);
+	int	(*get_double)(FT_HANDLE ftHandle, double *value);
+} DEVICE_OP;
+
+/* Entry of the command registry.
+ * schema has one character per argument: 'i' integer, 'w' word, in
+ * upper case if the argument may be left out, '*' for the rest of the
+ * line. Commands with on_device set run on the owner thread of the
+ * device, all others are answered right away. */
+struct command{
+	char		*name;
+	char		*schema;
+	int		on_device;
+	int		(*run)(FT_HANDLE ftHandle, REQUEST *r);
+	DEVICE_OP	op;
+	int		field;		// CONF_* set by the command, -1 if none
+	char		*format;	// of the value returned by a getter
+};
+
+static int cmd_run(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return r->cmd->op.run(ftHandle);
+}
+
+static int cmd_set_int(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return r->cmd->op.set_int(ftHandle, atoi(r->arg[0]));
+}
+
+static int cmd_get_int(FT_HANDLE ftHandle, REQUEST *r)
+{
+	int value, status;
+
+	status = r->cmd->op.get_int(ftHandle, &value);
+	if (status == OK)
+		snprintf(r->result, r->result_size, r->cmd->format, value);
+	return status;
+}
+
+static int cmd_get_double(FT_HANDLE ftHandle, REQUEST *r)
+{
+	double value;
+	int status;
+
+	status = r->cmd->op.get_double(ftHandle, &value);
+	if (status == OK)
+		snprintf(r->result, r->result_size, r->cmd->format, value);
+	return status;
+}
+
+static int cmd_get_housekeeping(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return get_housekeeping(r->result, r->result_size);
+}
+
+/* Set one field of PULSE_CONF, a batch of one */
+static int cmd_set_field(FT_HANDLE ftHandle, REQUEST *r)
+{
+	struct config_batch b;
+	char value[2*MAX_LENGTH + 2];
+	int status;
+
+	memset(&b, 0, sizeof(b));
+	b.conf = pulse_conf;
+	if (r->arg[1][0] != '\0')
+		snprintf(value, sizeof(value), "%s,%s", r->arg[0], r->arg[1]);
+	else
+		snprintf(value, sizeof(value), "%s", r->arg[0]);
+
+	status = parse_conf_value(r->cmd->field, value, &b);
+	if (status != OK)
+		return status;
+	return apply_config(ftHandle, &b);
+}
+
+/* "set_config <field>=<value> ...": check the configuration as a whole,
+ * apply it in one transaction and reply "<field>=<status>" per field */
+static int cmd_set_config(FT_HANDLE ftHandle, REQUEST *r)
+{
+	struct config_batch b;
+	char *pair, *saveptr;
+	int status, f, len = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.conf = pulse_conf;
+	for (pair = strtok_r(r->rest, " ", &saveptr); pair != NULL;
+	     pair = strtok_r(NULL, " ", &saveptr))
+		if ((status = parse_conf_field(pair, &b)) != OK)
+			return status;
+	if (b.mask == 0)
+		return ARG_ERR;
+
+	status = apply_config(ftHandle, &b);
+
+	for (f = 0; f < CONF_FIELDS && len < r->result_size; f++)
+		if (b.mask & 1<<f)
+			len += snprintf(r->result + len, r->result_size - len,
+					"%s%s=%s", len > 0 ? " " : "",
+					conf_names[f], status_name(b.results[f]));
+	return status;
+}
+
+/* "get_config": the settings the device has taken since its last
+ * reset, in the form of set_config */
+static int cmd_get_config(FT_HANDLE ftHandle, REQUEST *r)
+{
+	PULSE_CONF c;
+	char value[CONF_FIELDS][16];
+	int status, valid, f, len = 0;
+
+	status = get_pulse_conf(ftHandle, &c, &valid);
+	if (status != OK)
+		return status;
+
+	snprintf(value[CONF_N_SAMPLES], 16, "%d", c.n_samples);
+	snprintf(value[CONF_PW], 16, "%d", c.pw);
+	snprintf(value[CONF_DELAY], 16, "%d", c.delay);
+	snprintf(value[CONF_POL_PRECEDE], 16, "%d", c.pol_preced);
+	snprintf(value[CONF_ADC_DELAY], 16, "%d", c.adc_delay);
+	snprintf(value[CONF_MODE], 16, "%s", c.mode == CROSSPOL ? "CROSSPOL" :
+		 c.mode == COPOL ? "COPOL" : c.mode == RADIOMETER ? "RADIOMETER" :
+		 c.mode == CALIBRATE ? "CALIBRATE" : "?");
+	snprintf(value[CONF_ATTEN22], 16, "%d,%d", c.atten22_1, c.atten22_2);
+	snprintf(value[CONF_ATTEN35], 16, "%d,%d", c.atten35_1, c.atten35_2);
+
+	for (f = 0; f < CONF_LOOP_FREQ && len < r->result_size; f++)
+		if (valid & 1<<f)
+			len += snprintf(r->result + len, r->result_size - len,
+					"%s%s=%s", len > 0 ? " " : "",
+					conf_names[f], value[f]);
+	return OK;
+}
+
+static int cmd_read(FT_HANDLE ftHandle, REQUEST *r)
+{
+	char byte;
+
+	return read_byte(ftHandle, &byte);
+}
+
+static int cmd_write(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return write_byte(ftHandle, (char)atoi(r->arg[0]));
+}
+
+static int cmd_purge(FT_HANDLE ftHandle, REQUEST *r)
+{
+	FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+	return OK;
+}
+
+static int cmd_get_device_list(FT_HANDLE ftHandle, REQUEST *r)
+{
+	get_device_list_info();
+	return OK;
+}
+
+/* "set_burst_format" and "set_radar_format" */
+static int cmd_set_burst_format(FT_HANDLE ftHandle, REQUEST *r)
+{
+	int *format = strcmp(r->cmd->name,"set_radar_format") == 0 ?
+		      &radar_format : &burst_format;
+	int f;
+
+	if (strcmp(r->arg[0],"BINARY") == 0)
+		f = IQ_FORMAT_BINARY;
+	else if (strcmp(r->arg[0],"TEXT") == 0)
+		f = IQ_FORMAT_TEXT;
+	else{
+		syslog (LOG_NOTICE, "Unknown format.\n");
+		return ARG_ERR;
+	}
+	pthread_mutex_lock(&job_settings_lock);
+	*format = f;
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
+}
+
+static int cmd_set_rotation(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return parse_rotate_policy(&loop_rotation, r->arg[0], r->arg[1]);
+}
+
+static int cmd_set_prealloc(FT_HANDLE ftHandle, REQUEST *r)
+{
+	loop_rotation.prealloc = atol(r->arg[0]);
+	return OK;
+}
+
+static int cmd_set_outbox_quota(FT_HANDLE ftHandle, REQUEST *r)
+{
+	// in MB
+	if (atol(r->arg[0]) <= 0) return ARG_ERR;
+	__atomic_store_n(&outbox_quota, atol(r->arg[0])*1024*1024, __ATOMIC_RELAXED);
+	return OK;
+}
+
+/* Commands that run as jobs. config holds the fields set for the job
+ * only, e.g. "n_samples=75000" for bursts between slow loop records.
+ * It is guarded by job_settings_lock. */
+static struct job_command{
+	char	*name;
+	int	(*run)(JOB *job, struct job_settings *s);
+	char	config[128];
+} job_commands[] = {
+	{"start",	read_burst},
+	{"radar",	radar_sweep},
+	{"radar_adaptive",	radar_adaptive},
+};
+#define N_JOB_COMMANDS	(sizeof(job_commands)/sizeof(job_commands[0]))
+
+static struct job_command *job_command(char *name)
+{
+	int i;
+
+	for (i = 0; i < N_JOB_COMMANDS; i++)
+		if (strcmp(name, job_commands[i].name) == 0)
+			return &job_commands[i];
+	return NULL;
+}
+
+/* A failed restore is tried again this often before the slow loop is
+ * stopped, it would read its records with the wrong n_samples */
+#define JOB_RESTORE_TRIES	3
+
+/* Configuration of the device around a job */
+struct job_config{
+	char			fields[128];	// "<field>=<value> ..."
+	PULSE_CONF		conf;		// the job runs with
+	PULSE_CONF		saved;
+	int			saved_valid;
+	struct config_batch	batch;
+};
+
+/* Runs on the owner thread. Remember the configuration, apply the
+ * fields of the job on top of it and keep the result for the job. */
+static int job_config_enter(FT_HANDLE ftHandle, void *arg)
+{
+	struct job_config *j = (struct job_config*) arg;
+	char fields[128], *pair, *saveptr;
+	int status = OK;
+
+	j->saved = pulse_conf;
+	j->saved_valid = pulse_conf_valid;
+	job_config_active = 1;
+
+	memset(&j->batch, 0, sizeof(j->batch));
+	j->batch.conf = pulse_conf;
+	j->batch.job = 1;
+	snprintf(fields, sizeof(fields), "%s", j->fields);
+	for (pair = strtok_r(fields, " ", &saveptr); pair != NULL;
+	     pair = strtok_r(NULL, " ", &saveptr))
+		if ((status = parse_conf_field(pair, &j->batch)) != OK)
+			return status;
+	if (j->batch.mask != 0)
+		status = apply_config(ftHandle, &j->batch);
+	j->conf = pulse_conf;
+	return status;
+}
+
+/* Runs on the owner thread. Send back what the job changed, including
+ * the delay of a radar sweep. If that fails, a paused slow loop is
+ * stopped instead of started again. */
+static int job_config_leave(FT_HANDLE ftHandle, void *arg)
+{
+	struct job_config *j = (struct job_config*) arg;
+	int status = OK, tries;
+
+	for (tries = 0; tries < JOB_RESTORE_TRIES; tries++){
+		memset(&j->batch, 0, sizeof(j->batch));
+		j->batch.conf = j->saved;
+		j->batch.mask = changed_fields(&j->saved)
+				| (j->saved_valid & ~pulse_conf_valid);
+		j->batch.job = 1;
+		if (j->batch.mask == 0)
+			break;
+		status = apply_config(ftHandle, &j->batch);
+		if (status == OK)
+			break;
+		syslog(LOG_ERR, "Configuration not restored, status %d\n", status);
+	}
+	job_config_active = 0;
+	if (status != OK && slow_loop_keep_running == 1){
+		syslog(LOG_ERR, "Slow loop stopped, its configuration is lost\n");
+		stop_slow_loop(ftHandle);
+	}
+	return status;
+}
+
+/* Every job runs here. It keeps the device from its first to its last
+ * operation, so a running slow loop pauses once for the whole burst or
+ * sweep, with the configuration of the loop restored before it goes on.
+ * The length of the gap is written to the loop file. */
+static int run_job(JOB *job)
+{
+	struct job_command *c = job_command(job->name);
+	struct job_config j;
+	struct job_settings s;
+	int status, restored;
+
+	pthread_mutex_lock(&job_settings_lock);
+	snprintf(j.fields, sizeof(j.fields), "%s", c->config);
+	s.burst_format = burst_format;
+	s.radar_format = radar_format;
+	s.integration = radar_integration;
+	s.adaptive_samples = adaptive_samples;
+	s.adaptive_sigma = adaptive_sigma;
+	s.clutter_mode = clutter_mode;
+	s.clutter_alpha = clutter_alpha;
+	pthread_mutex_unlock(&job_settings_lock);
+
+	device_hold();
+	status = device_call(job_config_enter, &j);
+	s.conf = j.conf;
+	if (status == OK)
+		status = c->run(job, &s);
+	else
+		syslog(LOG_ERR, "%s: configuration %s not applied, status %d\n",
+		       job->name, j.fields, status);
+	restored = device_call(job_config_leave, &j);
+	device_release();
+	return status != OK ? status : restored;
+}
+
+/* Queue job command name. Returns the job id, -1 if name is no job or
+ * the queue is full. The scheduler submits its jobs here as well. */
+static int submit_job(char *name)
+{
+	if (job_command(name) == NULL)
+		return -1;
+	return jobs_submit(name, run_job);
+}
+
+/* Long running commands are queued, the reply is the job id */
+static int cmd_submit_job(FT_HANDLE ftHandle, REQUEST *r)
+{
+	int id = submit_job(r->cmd->name);
+	if (id < 0) return ERR;
+	snprintf(r->result, r->result_size, "%d", id);
+	return OK;
+}
+
+/* "status [id]" and "result [id]", all jobs without id */
+static int cmd_describe_job(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return jobs_describe(atoi(r->arg[0]), r->result, r->result_size,
+			     strcmp(r->cmd->name,"result") == 0);
+}
+
+static int cmd_cancel(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return jobs_cancel(atoi(r->arg[0]));
+}
+
+/* "set_schedule <job> <sec> <min> <hour>" or "set_schedule <job> off" */
+static int cmd_set_schedule(FT_HANDLE ftHandle, REQUEST *r)
+{
+	char name[MAX_LENGTH];
+	int len = 0;
+
+	if (sscanf(r->rest, " %31s%n", name, &len) != 1)
+		return ARG_ERR;
+	if (job_command(name) == NULL){
+		syslog (LOG_NOTICE, "%s can not be scheduled\n", name);
+		return ARG_ERR;
+	}
+	return schedule_set(name, r->rest + len);
+}
+
+static int cmd_get_schedule(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return schedule_describe(r->result, r->result_size);
+}
+
+/* "set_job_config <job> <field>=<value> ...", fields of set_config that
+ * only hold while the job runs. Without fields the job runs with the
+ * configuration of the moment. */
+static int cmd_set_job_config(FT_HANDLE ftHandle, REQUEST *r)
 {
-	syslog (LOG_NOTICE, "Got SIGINT.\n");
-	keep_running = 0;
+	struct job_command *c;
+	struct config_batch b;
+	char name[MAX_LENGTH], fields[128], *pair, *saveptr;
+	int status, len = 0;
+
+	if (sscanf(r->rest, " %31s%n", name, &len) != 1
+	    || (c = job_command(name)) == NULL)
+		return ARG_ERR;
+
+	// the loop frequency is not part of pulse_conf and can not be restored
+	memset(&b, 0, sizeof(b));
+	b.conf = pulse_conf;
+	snprintf(fields, sizeof(fields), "%s", r->rest + len);
+	for (pair = strtok_r(fields, " ", &saveptr); pair != NULL;
+	     pair = strtok_r(NULL, " ", &saveptr))
+		if ((status = parse_conf_field(pair, &b)) != OK)
+			return status;
+	if (b.mask & 1<<CONF_LOOP_FREQ
+	    || check_pulse_conf(&b.conf, 0, b.mask) != OK)
+		return ARG_ERR;
+
+	len += strspn(r->rest + len, " ");
+	pthread_mutex_lock(&job_settings_lock);
+	snprintf(c->config, sizeof(c->config), "%s", r->rest + len);
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
 }
 
-int set_default(FT_HANDLE ftHandle)
+/* "set_radar_integration INCOHERENT|COHERENT|COHERENT_DRIFT" */
+static int cmd_set_radar_integration(FT_HANDLE ftHandle, REQUEST *r)
 {
-	int status;
-	
-	status = set_num_samples(ftHandle, 512);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
-	}
-	pulse_conf.n_samples = 512;
-	
-	status = set_delay(ftHandle, 222);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
-	}
-	pulse_conf.delay = 222;
-	
-	status = set_pw(ftHandle, 10);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
-	}
-	pulse_conf.pw = 10;
-	
-	status = set_adc(ftHandle, 1);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
+	int integration;
+
+	if (strcmp(r->arg[0],"INCOHERENT") == 0)
+		integration = RP_INCOHERENT;
+	else if (strcmp(r->arg[0],"COHERENT") == 0)
+		integration = RP_COHERENT;
+	else if (strcmp(r->arg[0],"COHERENT_DRIFT") == 0)
+		integration = RP_COHERENT_DRIFT;
+	else
+		return ARG_ERR;
+	pthread_mutex_lock(&job_settings_lock);
+	radar_integration = integration;
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
+}
+
+/* "set_radar_adaptive <coarse n_samples> <sigma>" for radar_adaptive */
+static int cmd_set_radar_adaptive(FT_HANDLE ftHandle, REQUEST *r)
+{
+	int n = atoi(r->arg[0]);
+	char *end;
+	double sigma = strtod(r->arg[1], &end);
+
+	if (n <= 0 || n%2 != 0 || *end != '\0' || !(sigma > 0))
+		return ARG_ERR;
+	pthread_mutex_lock(&job_settings_lock);
+	adaptive_samples = n;
+	adaptive_sigma = sigma;
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
+}
+
+/* "set_clutter OFF|HOLD|AUTO|CLEAR [alpha]" for the radar jobs */
+static int cmd_set_clutter(FT_HANDLE ftHandle, REQUEST *r)
+{
+	double alpha = -1;		// keep clutter_alpha
+	char *end = "";
+	int mode;
+
+	for (mode = CLUTTER_OFF; mode <= CLUTTER_CLEAR; mode++)
+		if (strcmp(r->arg[0], clutter_modes[mode]) == 0)
+			break;
+	if (r->arg[1][0] != '\0')
+		alpha = strtod(r->arg[1], &end);
+	if (mode > CLUTTER_CLEAR || *end != '\0'
+	    || !(alpha == -1 || (alpha > 0 && alpha <= 1)))
+		return ARG_ERR;
+	pthread_mutex_lock(&job_settings_lock);
+	clutter_mode = mode;
+	if (alpha != -1)
+		clutter_alpha = alpha;
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
+}
+
+/* State of the clutter map:
+ * "mode=<mode> alpha=<a> gates=<n> updates=<n> events=<n>" */
+static int cmd_get_clutter(FT_HANDLE ftHandle, REQUEST *r)
+{
+	pthread_mutex_lock(&job_settings_lock);
+	snprintf(r->result, r->result_size,
+		 "mode=%s alpha=%.3f gates=%d updates=%ld events=%ld",
+		 clutter_modes[clutter_mode], clutter_alpha, clutter_map.n_gates,
+		 clutter_map.updates, clutter_events);
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
+}
+
+/* "get_job_config <job>" */
+static int cmd_get_job_config(FT_HANDLE ftHandle, REQUEST *r)
+{
+	struct job_command *c = job_command(r->arg[0]);
+
+	if (c == NULL)
+		return ARG_ERR;
+	pthread_mutex_lock(&job_settings_lock);
+	snprintf(r->result, r->result_size, "%s", c->config);
+	pthread_mutex_unlock(&job_settings_lock);
+	return OK;
+}
+
+/* Pauses of the running slow loop: "gaps=<n> last=<s> max=<s>" */
+static int cmd_get_loop_gaps(FT_HANDLE ftHandle, REQUEST *r)
+{
+	snprintf(r->result, r->result_size, "gaps=%ld last=%.3f max=%.3f",
+		 slow_loop_gaps, slow_loop_last_gap, slow_loop_max_gap);
+	return OK;
+}
+
+static int cmd_start_slow_loop(FT_HANDLE ftHandle, REQUEST *r)
+{
+	static struct thread_args a;	// must outlive this call, the loop keeps using it
+	a.ftHandle = ftHandle;
+	a.read_buffer_size = pulse_conf.n_samples;
+	a.conf = &pulse_conf;
+	a.rotation = &loop_rotation;
+
+	// Queue the loop on the device owner. Do not wait for it to
+	// return. It can be stopped by calling stop_slow_loop.
+	return device_submit(strcmp(r->cmd->name,"start_slow_loop") == 0 ?
+			     run_slow_loop : run_slow_loop_calibrate, &a);
+}
+
+static int cmd_stop_slow_loop(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return stop_slow_loop(ftHandle);
+}
+
+static int cmd_start_distrometer(FT_HANDLE ftHandle, REQUEST *r)
+{
+	pthread_t distro_thread;
+	static struct distro_args a;	// must outlive this call, the thread keeps using it
+	static char device[MAX_LENGTH];
+
+	// a and device belong to the running reader until it ends
+	if (claim_distrometer() != OK)
+		return ERR;
+
+	// optional device, default is DISTRO_DEVICE
+	if (r->arg[0][0] != '\0'){
+		snprintf(device, sizeof(device), "%s", r->arg[0]);
+		a.device = device;
 	}
-	pulse_conf.adc_delay = 1;
-	
-	status = set_pol_precede(ftHandle, 0);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
+	else
+		a.device = DISTRO_DEVICE;
+	a.rotation = &distro_rotation;
+
+	// It can be stopped by calling stop_distrometer.
+	if (pthread_create(&distro_thread, NULL, start_distrometer, &a) != 0){
+		release_distrometer();
+		return ERR;
 	}
-	pulse_conf.pol_preced = 0;
-	
-	status = set_mode(ftHandle, COPOL);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
+	pthread_detach(distro_thread);
+	return OK;
+}
+
+static int cmd_stop_distrometer(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return stop_distrometer();
+}
+
+/* combined 1 s radar + distrometer product, same rotation as slow loop */
+static int cmd_start_fusion(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return fusion_start(&loop_rotation);
+}
+
+static int cmd_stop_fusion(FT_HANDLE ftHandle, REQUEST *r)
+{
+	return fusion_stop();
+}
+
+static int cmd_quit(FT_HANDLE ftHandle, REQUEST *r)
+{
+	keep_running = 0;
+	return OK;
+}
+
+#define DEV		1	// runs on the device owner
+#define NO_FIELD	-1
+
+/* Command registry, sorted by name for the lookup */
+static struct command commands[] = {
+	{"cancel",		"i",	0,   cmd_cancel,		{NULL},			NO_FIELD},
+	{"get_adc4",		"",	DEV, cmd_get_double,	{.get_double = get_adc4},	NO_FIELD, "%.4f"},
+	{"get_adc5",		"",	DEV, cmd_get_double,	{.get_double = get_adc5},	NO_FIELD, "%.4f"},
+	{"get_adc6",		"",	DEV, cmd_get_double,	{.get_double = get_adc6},	NO_FIELD, "%.4f"},
+	{"get_adc7",		"",	DEV, cmd_get_double,	{.get_double = get_adc7},	NO_FIELD, "%.4f"},
+	{"get_board_temp",	"",	DEV, cmd_get_double,	{.get_double = get_board_temp},	NO_FIELD, "%.1f"},
+	{"get_case_temp",	"",	DEV, cmd_get_double,	{.get_double = get_case_temp},	NO_FIELD, "%.1f"},
+	{"get_clutter",		"",	0,   cmd_get_clutter,	{NULL},			NO_FIELD},
+	{"get_config",		"",	DEV, cmd_get_config,	{NULL},			NO_FIELD},
+	{"get_device_list",	"",	0,   cmd_get_device_list,	{NULL},			NO_FIELD},
+	{"get_housekeeping",	"",	DEV, cmd_get_housekeeping,	{NULL},			NO_FIELD},
+	{"get_job_config",	"w",	0,   cmd_get_job_config,	{NULL},			NO_FIELD},
+	{"get_lock",		"",	DEV, cmd_get_int,	{.get_int = get_lock},		NO_FIELD, "%d"},
+	{"get_loop_gaps",	"",	0,   cmd_get_loop_gaps,	{NULL},			NO_FIELD},
+	{"get_reset_count",	"",	DEV, cmd_get_int,	{.get_int = get_reset_count},	NO_FIELD, "%d"},
+	{"get_schedule",	"",	0,   cmd_get_schedule,	{NULL},			NO_FIELD},
+	{"get_status",		"",	DEV, cmd_get_int,	{.get_int = get_status},	NO_FIELD, "%d"},
+	{"purge",		"",	DEV, cmd_purge,		{NULL},			NO_FIELD},
+	{"quit",		"",	0,   cmd_quit,		{NULL},			NO_FIELD},
+	{"radar",		"",	0,   cmd_submit_job,	{NULL},			NO_FIELD},
+	{"radar_adaptive",	"",	0,   cmd_submit_job,	{NULL},			NO_FIELD},
+	{"read",		"",	DEV, cmd_read,		{NULL},			NO_FIELD},
+	{"result",		"I",	0,   cmd_describe_job,	{NULL},			NO_FIELD},
+	{"set_adc_delay",	"i",	DEV, cmd_set_field,	{NULL},			CONF_ADC_DELAY},
+	{"set_atten22",		"ii",	DEV, cmd_set_field,	{NULL},			CONF_ATTEN22},
+	{"set_atten35",		"ii",	DEV, cmd_set_field,	{NULL},			CONF_ATTEN35},
+	{"set_board_temp",	"i",	DEV, cmd_set_int,	{.set_int = set_board_temp},	NO_FIELD},
+	{"set_burst_format",	"w",	0,   cmd_set_burst_format,	{NULL},			NO_FIELD},
+	{"set_case_temp",	"i",	DEV, cmd_set_int,	{.set_int = set_case_temp},	NO_FIELD},
+	{"set_clutter",		"wW",	0,   cmd_set_clutter,	{NULL},			NO_FIELD},
+	{"set_config",		"*",	DEV, cmd_set_config,	{NULL},			NO_FIELD},
+	{"set_default",		"",	DEV, cmd_run,		{.run = set_default},		NO_FIELD},
+	{"set_delay",		"i",	DEV, cmd_set_field,	{NULL},			CONF_DELAY},
+	{"set_job_config",	"*",	0,   cmd_set_job_config,	{NULL},			NO_FIELD},
+	{"set_loop_freq",	"i",	DEV, cmd_set_field,	{NULL},			CONF_LOOP_FREQ},
+	{"set_mode",		"w",	DEV, cmd_set_field,	{NULL},			CONF_MODE},
+	{"set_n_samples",	"i",	DEV, cmd_set_field,	{NULL},			CONF_N_SAMPLES},
+	{"set_outbox_quota",	"i",	0,   cmd_set_outbox_quota,	{NULL},			NO_FIELD},
+	{"set_pol_precede",	"i",	DEV, cmd_set_field,	{NULL},			CONF_POL_PRECEDE},
+	{"set_prealloc",	"i",	0,   cmd_set_prealloc,	{NULL},			NO_FIELD},
+	{"set_pw",		"i",	DEV, cmd_set_field,	{NULL},			CONF_PW},
+	{"set_radar_format",	"w",	0,   cmd_set_burst_format,	{NULL},			NO_FIELD},
+	{"set_radar_adaptive",	"iw",	0,   cmd_set_radar_adaptive,	{NULL},			NO_FIELD},
+	{"set_radar_integration",	"w",	0,   cmd_set_radar_integration,	{NULL},			NO_FIELD},
+	{"set_reset_count",	"",	DEV, cmd_run,		{.run = set_reset_count},	NO_FIELD},
+	{"set_rotation",	"wi",	0,   cmd_set_rotation,	{NULL},			NO_FIELD},
+	{"set_schedule",	"*",	0,   cmd_set_schedule,	{NULL},			NO_FIELD},
+	{"start",		"",	0,   cmd_submit_job,	{NULL},			NO_FIELD},
+	{"start_distrometer",	"W",	0,   cmd_start_distrometer,	{NULL},			NO_FIELD},
+	{"start_fusion",	"",	0,   cmd_start_fusion,	{NULL},			NO_FIELD},
+	{"start_slow_loop",	"",	0,   cmd_start_slow_loop,	{NULL},			NO_FIELD},
+	{"start_slow_loop_calibrate", "", 0, cmd_start_slow_loop,	{NULL},			NO_FIELD},
+	{"status",		"I",	0,   cmd_describe_job,	{NULL},			NO_FIELD},
+	{"stop_distrometer",	"",	0,   cmd_stop_distrometer,	{NULL},			NO_FIELD},
+	{"stop_fusion",		"",	0,   cmd_stop_fusion,	{NULL},			NO_FIELD},
+	{"stop_slow_loop",	"",	0,   cmd_stop_slow_loop,	{NULL},			NO_FIELD},
+	{"write",		"i",	DEV, cmd_write,		{NULL},			NO_FIELD},
+};
+#define N_COMMANDS	(sizeof(commands)/sizeof(commands[0]))
+
+static int compare_commands(const void *a, const void *b)
+{
+	return strcmp(((struct command*)a)->name, ((struct command*)b)->name);
+}
+
+/* Sort the registry, in case an entry was added out of order */
+void commands_init(void)
+{
+	qsort(commands, N_COMMANDS, sizeof(struct command), compare_commands);
+}
+
+/* Check the arguments of a request against the schema of its command */
+static int check_args(REQUEST *r)
+{
+	char *schema = r->cmd->schema, *end, *p = r->rest;
+	int n = strlen(schema), i, len, count = 0;
+
+	if (schema[0] == '*')
+		return r->rest[strspn(r->rest, " ")] != '\0' ? OK : ARG_ERR;
+
+	// arg[] only holds the first two arguments, cut to MAX_LENGTH - 1
+	while (*(p += strspn(p, " \t\r\n")) != '\0'){
+		len = strcspn(p, " \t\r\n");
+		if (len >= MAX_LENGTH || ++count > n)
+			return ARG_ERR;
+		p += len;
 	}
-	pulse_conf.mode = COPOL;
-	
-	status = set_atten22(ftHandle, 0, 0);
-	if (status != OK){
-		printf("error %d\n", status);
-		return status;
+
+	for (i = 0; i < 2; i++){
+		if (r->arg[i][0] == '\0'){
+			// missing, fine if the schema does not need it
+			if (i < n && islower(schema[i]))
+				return ARG_ERR;
+			continue;
+		}
+		if (i >= n)
+			return ARG_ERR;		// too many arguments
+		if (toupper(schema[i]) == 'I'){
+			strtol(r->arg[i], &end, 10);
+			if (*end != '\0')
+				return ARG_ERR;
+		}
 	}
-	pulse_conf.atten22_1 = 0;
-	pulse_conf.atten22_2 = 0;
-	
-	status = set_atten35(ftHandle, 0, 0);
+	return OK;
+}
+
+static int run_request(FT_HANDLE ftHandle, void *arg)
+{
+	REQUEST *r = (REQUEST*) arg;
+
+	return r->cmd->run(ftHandle, r);
+}
+
+/* A request with the buffers it is split into. A device command that
+ * is answered later keeps them until it has run. */
+struct request_buf{
+	char		request[SERVER_MAX_MSG + 1];
+	char		name[MAX_LENGTH];
+	char		arg1[MAX_LENGTH];
+	char		arg2[MAX_LENGTH];
+	char		result[SERVER_MAX_MSG];
+	REQUEST		r;
+	SERVER_PENDING	*pending;
+};
+
+static int format_reply(struct request_buf *b, int status, char *reply,
+			int reply_size)
+{
 	if (status != OK){
-		printf("error %d\n", status);
-		return status;
+		syslog (LOG_ERR, "Socket handler error number %d", status);
+		if (b->result[0] != '\0')
+			return snprintf(reply, reply_size, "ERR %d %s", status, b->result);
+		return snprintf(reply, reply_size, "ERR %d", status);
 	}
-	pulse_conf.atten35_1 = 0;
-	pulse_conf.atten35_2 = 0;
-	
+	if (b->result[0] != '\0')
+		return snprintf(reply, reply_size, "OK %s", b->result);
+	return snprintf(reply, reply_size, "OK");
+}
+
+/* Runs on the owner thread. A device command of the control server,
+ * the reply goes to the client through the server. */
+static int run_later(FT_HANDLE ftHandle, void *arg)
+{
+	struct request_buf *b = (struct request_buf*) arg;
+	SERVER_PENDING *p = b->pending;
+	int status = b->r.cmd->run(ftHandle, &b->r);
+
+	server_done(p, format_reply(b, status, p->reply, sizeof(p->reply)));
+	free(b);
 	return status;
 }
 
+/* Split a request of the control server into command and arguments and
+ * run it. With pending a device command is queued on the owner thread
+ * and answered later (SERVER_LATER), so the server does not wait for a
+ * burst or a sweep. Without pending it is waited for. */
+int handle_request(char *request, char *reply, int reply_size,
+		   SERVER_PENDING *pending)
+{
+	struct request_buf *b = malloc(sizeof(struct request_buf));
+	REQUEST *r;
+	struct command key;
+	int len = 0, status;
 
-/* State machine for commands sent via socket */
-int handle_socket_con(int fdSock)
-{
-	char message1[MAX_LENGTH];		// socket messages
-	char message2[MAX_LENGTH];
-	char message3[MAX_LENGTH];
-	int status = OK;				// function return status
-	
-	read(fdSock, message1, MAX_LENGTH);
-	read(fdSock, message2, MAX_LENGTH);
-	read(fdSock, message3, MAX_LENGTH);
-	
-	if (strcmp(message1,"set_case_temp") == 0)
-		set_case_temp(ftHandle,atoi(message2));
-			
-	else if (strcmp(message1,"get_case_temp") == 0)
-		get_case_temp(ftHandle);
-	
-	else if (strcmp(message1,"set_board_temp") == 0)
-		set_board_temp(ftHandle,atoi(message2));
-			
-	else if (strcmp(message1,"get_board_temp") == 0)
-		get_board_temp(ftHandle);
-				
-	else if (strcmp(message1,"set_reset_count") == 0)
-		set_reset_count(ftHandle);
-			
-	else if (strcmp(message1,"get_reset_count") == 0)
-		get_reset_count(ftHandle);
-		
-	else if (strcmp(message1,"set_default") == 0){
-		status = set_default(ftHandle);
-		if (status != OK) printf("error %d\n", status);
-	}
-	
-	else if (strcmp(message1,"set_pw") == 0){
-		status = set_pw(ftHandle, atoi(message2));
-		if (status != OK) printf("error %d\n", status);
-		pulse_conf.pw = atoi(message2);
-	}
-		
-	else if (strcmp(message1,"set_n_samples") == 0){
-		status = set_num_samples(ftHandle, atoi(message2));
-		if (status != OK) printf("error %d\n", status);
-		pulse_conf.n_samples = atoi(message2);
-	}
-			
-	else if (strcmp(message1,"set_delay") == 0){
-		if (atoi(message2) < pulse_conf.pw + 5){
-			printf("DELAY TO SMALL. DELAY MUST BE AT LEAST PW+5\n");
-			return ARG_ERR;
-		}
-		status = set_delay(ftHandle, atoi(message2));
-		if (status != OK) printf("error %d\n", status);
-		pulse_conf.delay = atoi(message2);
-	}
-	
-	else if (strcmp(message1,"set_adc_delay") == 0){
-		status = set_adc(ftHandle, atoi(message2));
-		if (status != OK) printf("error %d\n", status);
-                pulse_conf.adc_delay = atoi(message2);
+	if (b == NULL)
+		return snprintf(reply, reply_size, "ERR %d", ERR);
+	snprintf(b->request, sizeof(b->request), "%s", request);
+	b->name[0] = b->arg1[0] = b->arg2[0] = b->result[0] = '\0';
+	b->pending = pending;
+	r = &b->r;
+	r->arg[0] = b->arg1;
+	r->arg[1] = b->arg2;
+	r->result = b->result;
+	r->result_size = sizeof(b->result);
+
+	sscanf(b->request, " %31s%n", b->name, &len);
+	r->rest = b->request + len;
+	sscanf(r->rest, "%31s %31s", b->arg1, b->arg2);
+	if (!isspace(*r->rest) && *r->rest != '\0')
+		b->name[0] = '\0';		// name too long
+
+	key.name = b->name;
+	r->cmd = bsearch(&key, commands, N_COMMANDS, sizeof(struct command),
+			 compare_commands);
+	if (r->cmd == NULL){
+		syslog (LOG_NOTICE, "Unknown command.\n");
+		status = ARG_ERR;
 	}
-	
-	else if (strcmp(message1,"set_pol_precede") == 0){
-		status = set_pol_precede(ftHandle, atoi(message2));
-		if (status != OK) printf("error %d\n", status);
+	else if ((status = check_args(r)) != OK)
+		syslog (LOG_NOTICE, "Wrong arguments for %s\n", b->name);
+	else if (r->cmd->on_device && pending != NULL){
+		if (device_submit(run_later, b) == OK)
+			return SERVER_LATER;
+		status = ERR;
 	}
+	else if (r->cmd->on_device)
+		status = device_call(run_request, r);
+	else
+		status = r->cmd->run(ftHandle, r);
+
+	len = format_reply(b, status, reply, reply_size);
+	free(b);
+	return len;
+}
+
+/* Listen on the unix socket path as well. Peers are checked by the
+ * server (SO_PEERCRED). */
+int open_unix_socket(char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
 	
-	else if (strcmp(message1,"get_status") == 0){
-		status = get_status(ftHandle);
-		if (status != OK) printf("error %d\n", status);
-	}
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0)
+		return -1;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
 	
-	else if (strcmp(message1,"set_atten22") == 0){
-		status = set_atten22(ftHandle, atoi(message2), atoi(message3));
-		if (status != OK) printf("error %d\n", status);
-		pulse_conf.atten22_1 = atoi(message2);
-		pulse_conf.atten22_2 = atoi(message3);
+	// left behind if the daemon was killed, the lock file protects it
+	unlink(path);
+	if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0
+	    || chmod(path, 0660) != 0 || listen(fd, 5) != 0
+	    || server_listen(fd) != 0){
+		close(fd);
+		return -1;
 	}
-	
-	else if (strcmp(message1,"set_atten35") == 0){
-		status = set_atten35(ftHandle, atoi(message2), atoi(message3));
-		if (status != OK) printf("error %d\n", status);
-		pulse_conf.atten35_1 = atoi(message2);
-		pulse_conf.atten35_2 = atoi(message3);
+	return 0;
+}
+
+
+/* C O N F I G   F I L E */
+
+#define CONF_LINE		128
+#define CONF_MAX_REQUESTS	16
+
+/* What CONF_FILE asks for at startup */
+struct daemon_conf{
+	struct config_batch batch;	// pulse configuration, one transaction
+	int	usb_transfer_size;	// bytes
+	int	usb_latency;		// ms
+	int	usb_timeout;		// ms
+	char	requests[CONF_MAX_REQUESTS][CONF_LINE];	// "set_<key> <value>"
+	int	n_requests;
+	char	start[CONF_LINE];	// what is started at the end
+};
+
+/* Remove white space at both ends */
+static char *trim(char *s)
+{
+	char *end;
+
+	while (isspace((unsigned char)*s))
+		s++;
+	end = s + strlen(s);
+	while (end > s && isspace((unsigned char)end[-1]))
+		*--end = '\0';
+	return s;
+}
+
+/* Read the config file. Lines are "<key> = <value>", '#' starts a
+ * comment:
+ *	n_samples, pw, ...	fields of set_config, on top of set_default
+ *	usb_transfer_size, usb_latency, usb_timeout
+ *	outbox_dir		where finished files are published
+ *	start			e.g. "slow_loop fusion", each as "start_<name>"
+ * Any other key is run as the request "set_<key> <value>", e.g.
+ * "rotation = TIME 600". Returns -1 if there is no file. */
+static int read_config(char *path, struct daemon_conf *c)
+{
+	char line[CONF_LINE], *key, *value;
+	FILE *file;
+	int f, n = 0;
+
+	memset(c, 0, sizeof(*c));
+	c->batch.conf = default_conf;
+	c->batch.mask = PULSE_FIELDS;
+	c->usb_transfer_size = 64000;
+	// Setting latency to 2 ms leads to com problems, but
+	// it should be as short as possible...
+	//
+	// Setting it to 0 ms worked well with libftdi.so.0.47.
+	//
+	// With 1.0.2 we get a lot of read errors. Trying it now with 2 ms
+	//
+	c->usb_latency = 0;
+	c->usb_timeout = 15000;
+
+	if ((file = fopen(path, "r")) == NULL){
+		syslog(LOG_NOTICE, "No %s, the device is not configured\n", path);
+		return -1;
 	}
-	
-	else if (strcmp(message1,"set_loop_freq") == 0){
-		status = set_loop_freq(ftHandle, atoi(message2));
-		if (status != OK) printf("error %d\n", status);
-	}	
-	
-	else if (strcmp(message1,"set_mode") == 0){
-		if (strcmp(message2,"CROSSPOL") == 0){
-			status = set_mode(ftHandle, CROSSPOL);
-			if (status != OK) printf("error %d\n", status);
-			pulse_conf.mode = CROSSPOL;
-		}
-		else if (strcmp(message2,"COPOL") == 0){
-			status = set_mode(ftHandle, COPOL);
-			if (status != OK) printf("error %d\n", status);
-			pulse_conf.mode = COPOL;
-		}
-		else if (strcmp(message2,"RADIOMETER") == 0){
-			status = set_mode(ftHandle, RADIOMETER);
-			if (status != OK) printf("error %d\n", status);
-			pulse_conf.mode = RADIOMETER;
-		}
-		else if (strcmp(message2,"CALIBRATE") == 0){
-			status = set_mode(ftHandle, CALIBRATE);
-			if (status != OK) printf("error %d\n", status);
-			pulse_conf.mode = CALIBRATE;
-		}
-		else{
-			syslog (LOG_NOTICE, "Unknown mode.\n");
-			return ARG_ERR;
+
+	while (fgets(line, sizeof(line), file) != NULL){
+		n++;
+		if ((value = strchr(line, '#')) != NULL)
+			*value = '\0';
+		key = trim(line);
+		if (*key == '\0')
+			continue;
+		if ((value = strchr(key, '=')) == NULL){
+			syslog(LOG_ERR, "%s:%d: no value\n", path, n);
+			continue;
 		}
-	}
-		
-	else if (strcmp(message1,"start") == 0){
-		int N = pulse_conf.n_samples/2;			// n/2 samples per polarization
-		int n_bytes_to_read = 9*pulse_conf.n_samples; 	// 9 bytes data per polarization
-		
-		DATA_STRUCT *data = create_data_struct(N);
-		
-		time_t t_now;
-		struct tm *ts;
-		char filename[23], sys_string[100];
-		
-		int max_tries = 3;
-		int tries = 0;
-		int retry = 0;
-		
-		// read burst and retry if it fails
-		for(tries=0; tries<max_tries; tries++)
-		{
-			syslog(LOG_NOTICE, "n_of_tries %d\n", tries);
-		 
-			retry = 0;
- 
-			// Start measurement and read data
-			status = start_msrmnt(ftHandle, n_bytes_to_read, data);
-			if (status != OK){
-				syslog(LOG_ERR, "start_msrmnt: error %d\n", status);
-				FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
-				retry = 1;
-			}
-		  
-			// check if number of bytes read is OK
-			if(data->N != pulse_conf.n_samples/2){
-				syslog(LOG_ERR, "n_bytes_read wrong\n");
-				FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
-				retry = 1;
-			}
-			
-			// if no retry is needed
-			if (retry == 0){
-				// open file with timestamped filename
-				time(&t_now);
-				ts =gmtime(&t_now);
-				strftime(filename, 23, "iq_%Y%m%d_%H%M%S.dat", ts);
-				FILE *iq_file = fopen(filename,"w");
-
-				// write header
-				fprintf(iq_file, "# 35_H_I 35_H_Q 22_H_I 22_H_Q");
-				fprintf(iq_file, " 35_V_I 35_V_Q 22_V_I 22_V_Q\n");				
-	
-				// write data
-				int j = 0;
-				for (j = 0; j< data->N; j++){	
-					fprintf(iq_file,"%6d %6d %6d %6d %6d %6d %6d %6d %6d\n", j, 
-							data->h_i_35->values[j], data->h_q_35->values[j],
-							data->h_i_22->values[j], data->h_q_22->values[j], 
-							data->v_i_35->values[j], data->v_q_35->values[j],
-							data->v_i_22->values[j], data->v_q_22->values[j]);
-				}
-				// close file
-				fclose(iq_file);
-				// move file
-				sprintf(sys_string, "mv %s /root/data_to_send/", filename);
-				system(sys_string);
-				// exit loop, because nomore try is needed
+		*value++ = '\0';
+		key = trim(key);
+		value = trim(value);
+
+		for (f = 0; f < CONF_FIELDS; f++)
+			if (strcmp(key, conf_names[f]) == 0)
 				break;
-			}
+		if (f < CONF_FIELDS){
+			if (parse_conf_value(f, value, &c->batch) != OK)
+				syslog(LOG_ERR, "%s:%d: bad value of %s\n", path, n, key);
 		}
-		free_data_struct(data);
+		else if (strcmp(key, "usb_transfer_size") == 0)
+			c->usb_transfer_size = atoi(value);
+		else if (strcmp(key, "usb_latency") == 0)
+			c->usb_latency = atoi(value);
+		else if (strcmp(key, "usb_timeout") == 0)
+			c->usb_timeout = atoi(value);
+		else if (strcmp(key, "outbox_dir") == 0)
+			snprintf(outbox_dir, sizeof(outbox_dir), "%s", value);
+		else if (strcmp(key, "start") == 0)
+			snprintf(c->start, sizeof(c->start), "%s", value);
+		else if (c->n_requests < CONF_MAX_REQUESTS)
+			snprintf(c->requests[c->n_requests++], CONF_LINE,
+				 "set_%s %s", key, value);
+		else
+			syslog(LOG_ERR, "%s:%d: too many settings\n", path, n);
 	}
-	
-	else if (strcmp(message1,"radar") == 0){
-		int N = pulse_conf.n_samples/2;					
-		int n_bytes_to_read = 9*pulse_conf.n_samples;
-		
-		DATA_STRUCT *data = create_data_struct(N);
-		
-		// test without malloc
-		//DATA_STRUCT d;
-		//DATA_STRUCT *data = &d;
-		
-		time_t t_now;
-		struct tm *ts;
-		
-		char filename[23], sys_string[100];		
-		
-		// open file with timestamped filename
-		time(&t_now);
-		ts =gmtime(&t_now);
-		strftime(filename, 27, "radar_%Y%m%d_%H%M_%S.dat", ts);
-		FILE *rad_file = fopen(filename,"w");
-				
-		//FILE *rad_file = fopen("rad_data.dat","w"); // file for I_Q_data
-	
-		fprintf(rad_file, "# delay 35_H_A 35_H_P 22_H_A 22_H_P");
-		fprintf(rad_file, " 35_V_A 35_V_P 22_V_A 22_V_P\n");
-		
-		int delay;
-		for (delay = pulse_conf.pw + 6; delay < 235; delay += 2){
-			status = set_delay(ftHandle, delay);
-			if (status != OK) printf("error %d\n", status);
-			pulse_conf.delay = delay;
-				
-			status = start_msrmnt(ftHandle, n_bytes_to_read, data);
-			if (status != OK){
-			printf("error %d\n", status);
-			free(data);
-			return ERR;
-			}
-				
-			mean(data, SKIP);
-			std_dev(data, SKIP);
-			
-			printf("%6d %6d %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f ",
-					pulse_conf.delay, data->N,
-					data->h_a_22->mean, data->h_p_22->mean, 
-					data->h_a_35->mean, data->h_p_35->mean,
-					data->v_a_22->mean, data->v_p_22->mean, 
-					data->v_a_35->mean, data->v_p_35->mean);
-			printf("%5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f\n",
- 					data->h_a_22->std_dev, data->h_p_22->std_dev, 
- 					data->h_a_35->std_dev, data->h_p_35->std_dev,
- 					data->v_a_22->std_dev, data->v_p_22->std_dev, 
- 					data->v_a_35->std_dev, data->v_p_35->std_dev);					
-			
-			// Write to file
-			fprintf(rad_file, "%6d %6d %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f ",
-					pulse_conf.delay, data->N, 
-					data->h_a_35->mean, data->h_p_35->mean,
-					data->h_a_22->mean, data->h_p_22->mean,  
-					data->v_a_35->mean, data->v_p_35->mean,
-					data->v_a_22->mean, data->v_p_22->mean);	
-			fprintf(rad_file, "%5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f\n",
- 					data->h_a_22->std_dev, data->h_p_22->std_dev, 
- 					data->h_a_35->std_dev, data->h_p_35->std_dev,
- 					data->v_a_22->std_dev, data->v_p_22->std_dev, 
- 					data->v_a_35->std_dev, data->v_p_35->std_dev);					
-		}
-		fclose(rad_file);
-		free_data_struct(data);
-		// move data to transfer directory
-		sprintf(sys_string, "mv %s /root/data_to_send/", filename);
-		system(sys_string);
-	}
-	
-	else if (strcmp(message1,"start_slow_loop") == 0){
-		pthread_t slow_loop_thread;
-		struct thread_args a;
-		a.ftHandle = ftHandle;
-		a.read_buffer_size = pulse_conf.n_samples;
-		a.conf = &pulse_conf;
-		
-		struct sched_param param;
-		memset(&param, 0, sizeof(param));
-		param.sched_priority = 95;
-		int policy = SCHED_OTHER;
-		
-		int rc;
-		
-		// Start a thread for the slow measurement loop.
-		// Do not wait for it to return.
-		// It can be stopped by calling stop_slow_loop.
-		rc = pthread_create(&slow_loop_thread, NULL, start_slow_loop, &a);
-		rc = pthread_setschedparam(slow_loop_thread, policy, &param);
-	}
-	
-        else if (strcmp(message1,"start_slow_loop_calibrate") == 0){
-		pthread_t slow_loop_thread;
-		struct thread_args a;
-		a.ftHandle = ftHandle;
-		a.read_buffer_size = pulse_conf.n_samples;
-		a.conf = &pulse_conf;
-		
-		struct sched_param param;
-		memset(&param, 0, sizeof(param));
-		param.sched_priority = 95;
-		int policy = SCHED_OTHER;
-		
-		int rc;
-		
-		// Start a thread for the slow measurement loop.
-		// Do not wait for it to return.
-		// It can be stopped by calling stop_slow_loop.
-		rc = pthread_create(&slow_loop_thread, NULL, start_slow_loop_calibrate, &a);
-		rc = pthread_setschedparam(slow_loop_thread, policy, &param);
-	}
-        
-	else if (strcmp(message1,"stop_slow_loop") == 0)
-		stop_slow_loop(ftHandle);
-	
-	else if(strcmp(message1,"get_lock") == 0)
-		get_lock(ftHandle);
-	
-	else if (strcmp(message1,"get_adc4") == 0)
-		get_adc4(ftHandle);
+	fclose(file);
+	return 0;
+}
 
-	else if (strcmp(message1,"get_adc5") == 0)
-		get_adc5(ftHandle);
-	
-	else if (strcmp(message1,"get_adc6") == 0)
-		get_adc6(ftHandle);
-	
-	else if (strcmp(message1,"get_adc7") == 0)
-		get_adc7(ftHandle);
-	
-	else if (strcmp(message1,"get_device_list") == 0)
-		get_device_list_info();
-		
-	else if (strcmp(message1,"read") == 0){
-		char byte;
-		read_byte(ftHandle, &byte);
-	}
-		
-	else if (strcmp(message1,"write") == 0){
-		write_byte(ftHandle,(char)atoi(message2));
-	}
-		
-	else if (strcmp(message1,"purge") == 0){
-		FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
-	}
-		
-	else if (strcmp(message1,"quit") == 0){
-		keep_running = 0;
+/* Apply the config file and start measuring. A field the device did
+ * not take is logged, the acquisition is started anyway with what the
+ * device has (pulse_conf). */
+static void start_from_config(struct daemon_conf *c)
+{
+	char request[CONF_LINE], reply[SERVER_MAX_MSG], *name, *saveptr;
+	int status, f, i;
+
+	status = device_call(run_config, &c->batch);
+	for (f = 0; f < CONF_FIELDS; f++)
+		if (c->batch.mask & 1<<f && c->batch.results[f] != OK)
+			syslog(LOG_ERR, "%s: %s=%s\n", CONF_FILE, conf_names[f],
+			       status_name(c->batch.results[f]));
+	syslog(LOG_NOTICE, "Configuration of %s applied, status %d\n",
+	       CONF_FILE, status);
+
+	for (i = 0; i < c->n_requests; i++){
+		handle_request(c->requests[i], reply, sizeof(reply), NULL);
+		if (strncmp(reply, "OK", 2) != 0)
+			syslog(LOG_ERR, "%s: %s failed\n", CONF_FILE, c->requests[i]);
 	}
-	else{
-		syslog (LOG_NOTICE, "Unknown command.\n");
-		return ARG_ERR;
+
+	for (name = strtok_r(c->start, " ,", &saveptr); name != NULL;
+	     name = strtok_r(NULL, " ,", &saveptr)){
+		snprintf(request, sizeof(request), "start_%s", name);
+		handle_request(request, reply, sizeof(reply), NULL);
+		if (strncmp(reply, "OK", 2) != 0)
+			syslog(LOG_ERR, "%s: %s failed\n", CONF_FILE, request);
 	}
-	
-	return status;
 }
 
 
@@ -484,17 +1895,19 @@ int main()
 	struct sockaddr_in strAddr;
 	socklen_t lenAddr;
 	int fdSock;
-	int fdConn;
 	int status;
-	
-	/* delete unfinished data files */
-	system("rm *.dat");
+	int on = 1;
+	struct daemon_conf conf;
+	int have_conf;
 	
 	/* open log */
 	setlogmask (LOG_UPTO (LOG_NOTICE));
 	openlog ("attrracd", LOG_CONS | LOG_NDELAY, LOG_LOCAL1);
 	syslog (LOG_NOTICE, "##### Program started by User %d ####", getuid ());
-	 	
+	
+	/* read config file, it may name another outbox */
+	have_conf = read_config(CONF_FILE, &conf) == 0;
+	
 	/* look for and create lock file */
 	int fdlock = get_lock_file(MASTERD_LOCK_FILE);
 	if (fdlock == -1){
@@ -504,14 +1917,19 @@ int main()
 		exit(1);
 	}
 	
-	/* define the signal handler */
-	struct sigaction act;
-	/* function "terminate()" will be called if... */
-	act.sa_handler = terminate;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = 0;
-	/* ...we receive SIGNINT */
-	sigaction(SIGINT, &act, 0);
+	/* salvage and publish data files left behind by a crash or reset.
+	 * Only with the lock, the files of a running daemon are still open. */
+	recover_data_files(".");
+	
+	/* SIGINT and SIGTERM are read by the control server. This blocks
+	 * them, so it has to happen before any thread is started. */
+	if (server_init() != 0){
+		syslog (LOG_ERR, "Could not set up control server. Exit.");
+		close(fdlock);
+		unlink(MASTERD_LOCK_FILE);
+		closelog();
+		exit(1);
+	}
 	
 	/* open USB device */
 	status = open_device(&ftHandle);
@@ -526,27 +1944,37 @@ int main()
 		exit(1);
 	}
 	// Config device
-	FT_SetUSBParameters(ftHandle, 64000, 0);
-	// Setting latency to 2 ms leads to com problems, but
-	// it should be as short as possible...
-	//
-	// Setting it to 0 ms worked well with libftdi.so.0.47.
-	//
-	// With 1.0.2 we get a lot of read errors. Trying it now with 2 ms
-	//
-	FT_SetLatencyTimer(ftHandle, 0);
+	FT_SetUSBParameters(ftHandle, conf.usb_transfer_size, 0);
+	FT_SetLatencyTimer(ftHandle, conf.usb_latency);
 	FT_SetDtr(ftHandle);
 	FT_SetRts(ftHandle);
 	FT_SetFlowControl(ftHandle, FT_FLOW_RTS_CTS, 0, 0);
-	FT_SetTimeouts(ftHandle, 15000, 15000);
+	FT_SetTimeouts(ftHandle, conf.usb_timeout, conf.usb_timeout);
 	FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+	
+	/* sorted command registry for the lookup */
+	commands_init();
+	
+	/* from here on only the owner thread talks to the device */
+	device_init(ftHandle);
+	
+	/* worker for "start" and "radar" */
+	jobs_init();
+	
+	/* starts the jobs of set_schedule at their wall clock times */
+	schedule_init(submit_job);
+	
+	/* keep the outbox below its disk quota while the link is down */
+	static struct outbox_args outbox = {outbox_dir, &outbox_quota};
+	pthread_t outbox_thread;
+	pthread_create(&outbox_thread, NULL, outbox_loop, &outbox);
+	
+	/* configure the device in one transaction and start measuring */
+	if (have_conf)
+		start_from_config(&conf);
 		
 	/* daemonize */
 	
-	/* read config file */
-//	masterd_conf_struct masterd_conf;
-//	read_masterd_config(&masterd_conf);
-	
 	/* start or restart daqd and sendd */
 	// quick and dirty... --> rewrite?! 
 //	system ("killall -SIGINT daqd");
@@ -566,10 +1994,11 @@ int main()
 		exit(1);
 	}
 	// set inet socket
+	setsockopt(fdSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
 	strAddr.sin_family=AF_INET;
 	strAddr.sin_addr.s_addr = inet_addr("127.0.0.1");
 	//strAddr.sin_addr.s_addr = htons(INADDR_ANY);
-	strAddr.sin_port = htons(1111);
+	strAddr.sin_port = htons(SERVER_PORT);
 	lenAddr=sizeof(struct sockaddr);
 	// bind socket to port
 	if (bind(fdSock, (struct sockaddr*)&strAddr, lenAddr) != 0) {
@@ -582,29 +2011,23 @@ int main()
 		exit(1);
 	}
 	
-	lenAddr = sizeof(struct sockaddr_in);
+	server_listen(fdSock);
+	
+	/* local clients use the unix socket, no port and no TCP overhead */
+	if (open_unix_socket(SOCKET_PATH) != 0)
+		syslog (LOG_ERR, "Could not open %s, only TCP is served", SOCKET_PATH);
+	
+	/* main loop : runs until SIGINT / SIGTERM arrives or *
+	 * the command "quit" changes "keep_running" to 0     */
+	server_run(handle_request, &keep_running);
 	
-	/* main loop : runs as long as the signal handler did *
-	 * not receive a SIGINT to change "keep_running" to 0 */
-	while(keep_running == 1){
-		usleep(5000);		
-		/* accept socket connection */
-		fdConn=accept(fdSock, (struct sockaddr*)&strAddr, &lenAddr);
-		syslog (LOG_INFO, "Socket connection accepted");
-		/* handle and evaluate incomming data */
-		status = handle_socket_con(fdConn);
-		if (status != OK){
-			syslog (LOG_ERR, "Socket handler error number %d", status);
-		}
-		/* close connection descriptor */
-		close(fdConn);
-	}
 	/* clean up and exit*/
 	syslog (LOG_NOTICE, "clean up and exit\n");
 	/* close lockfile descriptor */
 	close(fdlock);
-	/* close socket */
-	close(fdSock);
+	/* close clients and socket */
+	server_close();
+	unlink(SOCKET_PATH);
 	/* erase lockfile */
 	unlink(MASTERD_LOCK_FILE);
 	closelog();
@@ -0,0 +1,119 @@
+/*
+ * bench_writer.c - Compare the burst writers of data_writer.c with the
+ * plain fprintf output used before.
+ *
+ * Usage: bench_writer [N]	(default N = 37500, one minute burst)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include "usb_control.h"
+#include "helper.h"
+#include "data_writer.h"
+
+#define FILE_FPRINTF	"bench_fprintf.dat"
+#define FILE_TEXT	"bench_text.dat"
+#define FILE_BINARY	"bench_binary.bin"
+
+static double t_diff(struct timeval *t0, struct timeval *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) + (t1->tv_usec - t0->tv_usec)/1e6;
+}
+
+// The writer used in attrracd.c before data_writer.c existed
+static void write_fprintf(FILE *iq_file, DATA_STRUCT *data)
+{
+	int j;
+
+	fprintf(iq_file, "# 35_H_I 35_H_Q 22_H_I 22_H_Q");
+	fprintf(iq_file, " 35_V_I 35_V_Q 22_V_I 22_V_Q\n");
+	for (j = 0; j< data->N; j++){
+		fprintf(iq_file,"%6d %6d %6d %6d %6d %6d %6d %6d %6d\n", j,
+				data->h_i_35->values[j], data->h_q_35->values[j],
+				data->h_i_22->values[j], data->h_q_22->values[j],
+				data->v_i_35->values[j], data->v_q_35->values[j],
+				data->v_i_22->values[j], data->v_q_22->values[j]);
+	}
+}
+
+// Compare two files byte by byte
+static int same_content(char *name1, char *name2)
+{
+	FILE *f1 = fopen(name1, "r");
+	FILE *f2 = fopen(name2, "r");
+	int c1, c2;
+
+	if (f1 == NULL || f2 == NULL)
+		return 0;
+	do{
+		c1 = getc(f1);
+		c2 = getc(f2);
+	} while (c1 == c2 && c1 != EOF);
+	fclose(f1);
+	fclose(f2);
+	return c1 == c2;
+}
+
+int main(int argc, char *argv[])
+{
+	int N = 37500;
+	int j;
+	struct timeval t0, t1, tim;
+	PULSE_CONF conf;
+	FILE *file;
+
+	if (argc > 1)
+		N = atoi(argv[1]);
+
+	// fill data struct with values covering the full ADC range
+	DATA_STRUCT *data = create_data_struct(N);
+	data->N = N;
+	srand(1);
+	for (j = 0; j < N; j++){
+		data->h_i_35->values[j] = rand()%4096 - 2048 + ADC_OFFSET_I_35;
+		data->h_q_35->values[j] = rand()%4096 - 2048 + ADC_OFFSET_Q_35;
+		data->h_i_22->values[j] = rand()%4096 - 2048 + ADC_OFFSET_I_22;
+		data->h_q_22->values[j] = rand()%4096 - 2048 + ADC_OFFSET_Q_22;
+		data->v_i_35->values[j] = rand()%4096 - 2048 + ADC_OFFSET_I_35;
+		data->v_q_35->values[j] = rand()%4096 - 2048 + ADC_OFFSET_Q_35;
+		data->v_i_22->values[j] = rand()%4096 - 2048 + ADC_OFFSET_I_22;
+		data->v_q_22->values[j] = rand()%4096 - 2048 + ADC_OFFSET_Q_22;
+	}
+	memset(&conf, 0, sizeof(conf));
+	conf.n_samples = 2*N;
+
+	gettimeofday(&t0, NULL);
+	file = fopen(FILE_FPRINTF, "w");
+	write_fprintf(file, data);
+	fclose(file);
+	gettimeofday(&t1, NULL);
+	printf("fprintf     : %8.4f s\n", t_diff(&t0, &t1));
+
+	gettimeofday(&t0, NULL);
+	write_iq_burst(FILE_TEXT, data, &conf, &t0, IQ_FORMAT_TEXT);
+	gettimeofday(&t1, NULL);
+	printf("text buffer : %8.4f s\n", t_diff(&t0, &t1));
+
+	gettimeofday(&t0, NULL);
+	tim = t0;
+	write_iq_burst(FILE_BINARY, data, &conf, &tim, IQ_FORMAT_BINARY);
+	gettimeofday(&t1, NULL);
+	printf("binary      : %8.4f s\n", t_diff(&t0, &t1));
+
+	if (!same_content(FILE_FPRINTF, FILE_TEXT)){
+		printf("ERROR: text output differs from fprintf output\n");
+		free_data_struct(data);
+		return 1;
+	}
+	printf("text output identical to fprintf output\n");
+
+	unlink(FILE_FPRINTF);
+	unlink(FILE_TEXT);
+	unlink(FILE_BINARY);
+	free_data_struct(data);
+	return 0;
+}
@@ -0,0 +1,1011 @@
+/*
+ * data_writer.c - Writing of measurement data to files
+ */
+
+#define _GNU_SOURCE		/* for fallocate */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/time.h>
+#include <zlib.h>
+
+#include "attrracd.h"
+#include "usb_control.h"
+#include "data_writer.h"
+#include "outbox.h"
+
+
+/**************************/
+/* FAST INTEGER FORMATING */
+/**************************/
+
+// Write integer v right aligned in a field of at least 'width' chars.
+// Gives the same result as sprintf(p, "%*d", width, v) without the
+// overhead of parsing the format string for every value.
+int fmt_int(char *p, int v, int width)
+{
+	char digits[12];
+	int n = 0;
+	int len, i;
+	unsigned int u = (v < 0) ? -(unsigned int)v : (unsigned int)v;
+
+	do{
+		digits[n++] = '0' + u % 10;
+		u /= 10;
+	} while (u != 0);
+
+	len = n + (v < 0);
+	for (i = len; i < width; i++)
+		*p++ = ' ';
+	if (v < 0)
+		*p++ = '-';
+	while (n > 0)
+		*p++ = digits[--n];
+
+	return (len < width) ? width : len;
+}
+
+
+/*********************/
+/* BURST I/Q WRITERS */
+/*********************/
+
+// Write burst I/Q data as text. Lines are formatted into a large buffer
+// which is written to the file whenever it is almost full.
+int write_iq_text(FILE *file, DATA_STRUCT *data)
+{
+	char *buf = malloc(WRITE_BUF_SIZE);
+	char *p;
+	int j;
+
+	// longest line: 9 fields of max. 11 chars + 9 separators
+	int max_line = 9*12;
+
+	if (buf == NULL){
+		syslog(LOG_ERR, "write_iq_text: could not allocate buffer\n");
+		return ERR;
+	}
+
+	p = buf;
+	for (j = 0; j < data->N; j++){
+		p += fmt_int(p, j, 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->h_i_35->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->h_q_35->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->h_i_22->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->h_q_22->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->v_i_35->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->v_q_35->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->v_i_22->values[j], 6);
+		*p++ = ' ';
+		p += fmt_int(p, data->v_q_22->values[j], 6);
+		*p++ = '\n';
+
+		// flush buffer if the next line might not fit
+		if (p - buf > WRITE_BUF_SIZE - max_line){
+			fwrite(buf, 1, p - buf, file);
+			p = buf;
+		}
+	}
+	fwrite(buf, 1, p - buf, file);
+	free(buf);
+
+	if (ferror(file)){
+		syslog(LOG_ERR, "write_iq_text: write error\n");
+		return ERR;
+	}
+	return OK;
+}
+
+// Pack two 12 bit values into three bytes (see data_writer.h)
+static void pack_12bit(unsigned char *p, int a, int b)
+{
+	p[0] = a & 0xFF;
+	p[1] = ((a >> 8) & 0x0F) | ((b & 0x0F) << 4);
+	p[2] = (b >> 4) & 0xFF;
+}
+
+// Write burst I/Q data in the packed binary format. The ADC offsets
+// are removed again so that each value fits into 12 bits.
+int write_iq_binary(FILE *file, DATA_STRUCT *data, PULSE_CONF *conf,
+		    struct timeval *tim)
+{
+	IQ_BIN_HEADER header;
+	unsigned char *buf, *p;
+	int j;
+	int record_size = IQ_BIN_CHANNELS*3/2;
+	int records_per_buf = WRITE_BUF_SIZE / record_size;
+
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, IQ_BIN_MAGIC, sizeof(header.magic));
+	header.version     = IQ_BIN_VERSION;
+	header.header_size = sizeof(header);
+	header.t_sec       = tim->tv_sec;
+	header.t_usec      = tim->tv_usec;
+	header.N           = data->N;
+	header.n_channels  = IQ_BIN_CHANNELS;
+	header.n_samples   = conf->n_samples;
+	header.pw          = conf->pw;
+	header.delay       = conf->delay;
+	header.pol_preced  = conf->pol_preced;
+	header.adc_delay   = conf->adc_delay;
+	header.mode        = conf->mode;
+	header.atten22_1   = conf->atten22_1;
+	header.atten22_2   = conf->atten22_2;
+	header.atten35_1   = conf->atten35_1;
+	header.atten35_2   = conf->atten35_2;
+	header.adc_offset[0] = ADC_OFFSET_I_35;
+	header.adc_offset[1] = ADC_OFFSET_Q_35;
+	header.adc_offset[2] = ADC_OFFSET_I_22;
+	header.adc_offset[3] = ADC_OFFSET_Q_22;
+
+	fwrite(&header, sizeof(header), 1, file);
+
+	buf = malloc(records_per_buf*record_size);
+	if (buf == NULL){
+		syslog(LOG_ERR, "write_iq_binary: could not allocate buffer\n");
+		return ERR;
+	}
+
+	p = buf;
+	for (j = 0; j < data->N; j++){
+		pack_12bit(p,     data->h_i_35->values[j] - ADC_OFFSET_I_35,
+				  data->h_q_35->values[j] - ADC_OFFSET_Q_35);
+		pack_12bit(p + 3, data->h_i_22->values[j] - ADC_OFFSET_I_22,
+				  data->h_q_22->values[j] - ADC_OFFSET_Q_22);
+		pack_12bit(p + 6, data->v_i_35->values[j] - ADC_OFFSET_I_35,
+				  data->v_q_35->values[j] - ADC_OFFSET_Q_35);
+		pack_12bit(p + 9, data->v_i_22->values[j] - ADC_OFFSET_I_22,
+				  data->v_q_22->values[j] - ADC_OFFSET_Q_22);
+		p += record_size;
+
+		if (p - buf == records_per_buf*record_size){
+			fwrite(buf, 1, p - buf, file);
+			p = buf;
+		}
+	}
+	fwrite(buf, 1, p - buf, file);
+	free(buf);
+
+	if (ferror(file)){
+		syslog(LOG_ERR, "write_iq_binary: write error\n");
+		return ERR;
+	}
+	return OK;
+}
+
+// Open filename, write the burst in the given format and close it
+int write_iq_burst(char *filename, DATA_STRUCT *data, PULSE_CONF *conf,
+		   struct timeval *tim, int format)
+{
+	int status;
+	FILE *iq_file = fopen(filename, "w");
+
+	if (iq_file == NULL){
+		syslog(LOG_ERR, "Could not open %s\n", filename);
+		return ERR;
+	}
+
+	if (format == IQ_FORMAT_BINARY){
+		status = write_iq_binary(iq_file, data, conf, tim);
+	}
+	else{
+		// write header
+		fprintf(iq_file, "# 35_H_I 35_H_Q 22_H_I 22_H_Q");
+		fprintf(iq_file, " 35_V_I 35_V_Q 22_V_I 22_V_Q\n");
+		status = write_iq_text(iq_file, data);
+	}
+
+	if (fclose(iq_file) != 0)
+		status = ERR;
+
+	return status;
+}
+
+
+/************************/
+/* RANGE PROFILE WRITER */
+/************************/
+
+// Text lines as the radar sweep wrote them gate by gate: delay, N, the
+// means and the standard deviations with 22 GHz first per polarization.
+// Coherent integration appends amplitude, phase and SNR per receiver.
+static void write_range_profile_text(FILE *file, RANGE_PROFILE *rp)
+{
+	static const int sd_order[RP_CHANNELS] = {2, 3, 0, 1, 6, 7, 4, 5};
+	RP_GATE *g;
+	int i, c;
+
+	if (rp->residual){
+		fprintf(file, "# residual after the clutter map, delay N then amplitude,"
+			" phase and SNR per receiver: 35_H 22_H 35_V 22_V\n");
+		for (i = 0; i < rp->n_gates; i++){
+			g = &rp->gate[i];
+			fprintf(file, "%6d %6d", g->delay, g->N);
+			for (c = 0; c < RP_RECEIVERS; c++)
+				fprintf(file, " %5.1f %5.1f %5.1f", g->coh_amp[c],
+					g->coh_phase[c], g->snr[c]);
+			fprintf(file, "\n");
+		}
+		return;
+	}
+
+	fprintf(file, "# delay 35_H_A 35_H_P 22_H_A 22_H_P");
+	fprintf(file, " 35_V_A 35_V_P 22_V_A 22_V_P\n");
+	if (rp->integration != RP_INCOHERENT){
+		fprintf(file, "# then amplitude, phase and SNR of the coherent mean%s:",
+			rp->integration == RP_COHERENT_DRIFT ? " (drift removed)" : "");
+		fprintf(file, " 35_H 22_H 35_V 22_V\n");
+	}
+	for (i = 0; i < rp->n_gates; i++){
+		g = &rp->gate[i];
+		fprintf(file, "%6d %6d", g->delay, g->N);
+		for (c = 0; c < RP_CHANNELS; c++)
+			fprintf(file, " %5.1f", g->mean[c]);
+		for (c = 0; c < RP_CHANNELS; c++)
+			fprintf(file, " %5.1f", g->std_dev[sd_order[c]]);
+		for (c = 0; rp->integration != RP_INCOHERENT && c < RP_RECEIVERS; c++)
+			fprintf(file, " %5.1f %5.1f %5.1f", g->coh_amp[c],
+				g->coh_phase[c], g->snr[c]);
+		fprintf(file, "\n");
+	}
+}
+
+static void write_range_profile_binary(FILE *file, RANGE_PROFILE *rp)
+{
+	RP_BIN_HEADER header;
+	RP_RESIDUAL_GATE res;
+	int i;
+
+	memset(&header, 0, sizeof(header));
+	strncpy(header.magic, RP_BIN_MAGIC, sizeof(header.magic));
+	header.version     = RP_BIN_VERSION;
+	header.header_size = sizeof(header);
+	header.t_sec       = rp->tim.tv_sec;
+	header.t_usec      = rp->tim.tv_usec;
+	header.n_gates     = rp->n_gates;
+	header.n_channels  = RP_CHANNELS;
+	header.n_samples   = rp->conf.n_samples;
+	header.pw          = rp->conf.pw;
+	header.pol_preced  = rp->conf.pol_preced;
+	header.adc_delay   = rp->conf.adc_delay;
+	header.mode        = rp->conf.mode;
+	header.atten22_1   = rp->conf.atten22_1;
+	header.atten22_2   = rp->conf.atten22_2;
+	header.atten35_1   = rp->conf.atten35_1;
+	header.atten35_2   = rp->conf.atten35_2;
+	header.integration = rp->integration;
+	header.residual    = rp->residual;
+
+	fwrite(&header, sizeof(header), 1, file);
+	if (!rp->residual){
+		fwrite(rp->gate, sizeof(RP_GATE), rp->n_gates, file);
+		return;
+	}
+	for (i = 0; i < rp->n_gates; i++){
+		res.delay = rp->gate[i].delay;
+		res.N = rp->gate[i].N;
+		memcpy(res.amp, rp->gate[i].coh_amp, sizeof(res.amp));
+		memcpy(res.phase, rp->gate[i].coh_phase, sizeof(res.phase));
+		memcpy(res.snr, rp->gate[i].snr, sizeof(res.snr));
+		fwrite(&res, sizeof(res), 1, file);
+	}
+}
+
+// Open filename, write the range profile in the given format and close it
+int write_range_profile(char *filename, RANGE_PROFILE *rp, int format)
+{
+	int status = OK;
+	FILE *file = fopen(filename, "w");
+
+	if (file == NULL){
+		syslog(LOG_ERR, "Could not open %s\n", filename);
+		return ERR;
+	}
+
+	if (format == IQ_FORMAT_BINARY)
+		write_range_profile_binary(file, rp);
+	else
+		write_range_profile_text(file, rp);
+
+	if (ferror(file)){
+		syslog(LOG_ERR, "write_range_profile: write error\n");
+		status = ERR;
+	}
+	if (fclose(file) != 0)
+		status = ERR;
+	return status;
+}
+
+// Open filename, write a snapshot of the clutter map and close it
+int write_clutter_map(char *filename, CLUTTER_MAP *cm, time_t t, int format)
+{
+	CM_BIN_HEADER header;
+	int32_t delay;
+	float iq[2*RP_RECEIVERS];
+	int status = OK;
+	int i, c;
+	FILE *file = fopen(filename, "w");
+
+	if (file == NULL){
+		syslog(LOG_ERR, "Could not open %s\n", filename);
+		return ERR;
+	}
+
+	if (format == IQ_FORMAT_BINARY){
+		memset(&header, 0, sizeof(header));
+		strncpy(header.magic, CM_BIN_MAGIC, sizeof(header.magic));
+		header.version     = CM_BIN_VERSION;
+		header.header_size = sizeof(header);
+		header.t_sec       = t;
+		header.n_gates     = cm->n_gates;
+		header.n_receivers = RP_RECEIVERS;
+		header.updates     = cm->updates;
+		header.alpha       = cm->alpha;
+		fwrite(&header, sizeof(header), 1, file);
+	}
+	else{
+		fprintf(file, "# clutter map, alpha = %.3f, updates = %ld\n",
+			cm->alpha, cm->updates);
+		fprintf(file, "# delay then I Q per receiver: 35_H 22_H 35_V 22_V\n");
+	}
+	for (i = 0; i < cm->n_gates; i++){
+		for (c = 0; c < RP_RECEIVERS; c++){
+			iq[2*c] = cm->re[i][c];
+			iq[2*c+1] = cm->im[i][c];
+		}
+		if (format == IQ_FORMAT_BINARY){
+			delay = cm->delay[i];
+			fwrite(&delay, sizeof(delay), 1, file);
+			fwrite(iq, sizeof(iq), 1, file);
+			continue;
+		}
+		fprintf(file, "%6d", cm->delay[i]);
+		for (c = 0; c < 2*RP_RECEIVERS; c++)
+			fprintf(file, " %7.1f", iq[c]);
+		fprintf(file, "\n");
+	}
+
+	if (ferror(file)){
+		syslog(LOG_ERR, "write_clutter_map: write error\n");
+		status = ERR;
+	}
+	if (fclose(file) != 0)
+		status = ERR;
+	return status;
+}
+
+
+/**************/
+/* DATA FILES */
+/**************/
+
+// Parse a rotation policy, e.g. "TIME" "600" or "SIZE" "1000000"
+int parse_rotate_policy(ROTATE_POLICY *policy, char *mode, char *value)
+{
+	long v = atol(value);
+
+	if (v <= 0){
+		syslog(LOG_NOTICE, "Rotation value must be > 0\n");
+		return ARG_ERR;
+	}
+
+	if (strcmp(mode, "TIME") == 0)
+		policy->mode = ROTATE_TIME;
+	else if (strcmp(mode, "SIZE") == 0)
+		policy->mode = ROTATE_SIZE;
+	else if (strcmp(mode, "RECORDS") == 0)
+		policy->mode = ROTATE_RECORDS;
+	else{
+		syslog(LOG_NOTICE, "Unknown rotation mode %s\n", mode);
+		return ARG_ERR;
+	}
+	policy->value = v;
+
+	syslog(LOG_NOTICE, "Set rotation to %s %ld\n", mode, v);
+	return OK;
+}
+
+// Build a timestamped file name prefix_YYYYmmdd_HHMM[SS].dat. Seconds
+// are only added if files can be started within the same minute.
+// 1 if name is taken in the working dir or in the outbox, as it is
+// published (gzipped or not) or while the uploader sends it
+static int file_name_used(char *name)
+{
+	char path[256];
+
+	if (access(name, F_OK) == 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s/%s", outbox_dir, name);
+	if (access(path, F_OK) == 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s/%s.gz", outbox_dir, name);
+	if (access(path, F_OK) == 0)
+		return 1;
+	snprintf(path, sizeof(path), "%s/" OUTBOX_CLAIM_PREFIX "%s.gz",
+		 outbox_dir, name);
+	return access(path, F_OK) == 0;
+}
+
+void data_file_name(char *name, int size, char *prefix, time_t t,
+		    ROTATE_POLICY *policy)
+{
+	char format[64], stamp[64];
+	struct tm *ts = gmtime(&t);
+	int n;
+
+	if (policy->mode == ROTATE_TIME && policy->value % 60 == 0)
+		snprintf(format, sizeof(format), "%s%%Y%%m%%d_%%H%%M", prefix);
+	else
+		snprintf(format, sizeof(format), "%s%%Y%%m%%d_%%H%%M%%S", prefix);
+	strftime(stamp, sizeof(stamp), format, ts);
+
+	// a file started in the same second must not replace this one
+	snprintf(name, size, "%s.dat", stamp);
+	for (n = 1; file_name_used(name) && n < 1000; n++)
+		snprintf(name, size, "%s_%d.dat", stamp, n);
+}
+
+// Open a new data file for writing. policy may be NULL if the file is
+// never rotated.
+int data_file_open(DATA_FILE *df, char *name, ROTATE_POLICY *policy)
+{
+	long prealloc = 0;
+	time_t now = time(NULL);
+
+	strncpy(df->name, name, sizeof(df->name) - 1);
+	df->name[sizeof(df->name) - 1] = '\0';
+	df->records = 0;
+	df->records_ckpt = 0;
+	df->zone_file = NULL;
+
+	if (policy != NULL){
+		df->policy = *policy;
+		prealloc = policy->prealloc;
+		if (prealloc == 0 && policy->mode == ROTATE_SIZE)
+			prealloc = policy->value;
+	}
+	else{
+		df->policy.mode = ROTATE_RECORDS;
+		df->policy.value = 0;		// never
+		df->policy.prealloc = 0;
+	}
+
+	// next rotation at the next multiple of the period, so that
+	// files start at full minutes, hours, ...
+	if (df->policy.mode == ROTATE_TIME)
+		df->rotate_at = (now / df->policy.value + 1) * df->policy.value;
+
+	df->file = fopen(df->name, "w");
+	if (df->file == NULL){
+		syslog(LOG_ERR, "Could not open %s\n", df->name);
+		return ERR;
+	}
+
+	// Reserve the space of the whole file without changing its size,
+	// so readers and the recovery never see the preallocated blocks
+	if (prealloc > 0
+	    && fallocate(fileno(df->file), FALLOC_FL_KEEP_SIZE, 0, prealloc) != 0)
+		syslog(LOG_NOTICE, "fallocate of %s failed\n", df->name);
+
+	return OK;
+}
+
+// Check if the rotation policy asks for a new file
+int data_file_rotate_due(DATA_FILE *df, time_t now)
+{
+	switch (df->policy.mode){
+	case ROTATE_TIME:
+		return now >= df->rotate_at;
+	case ROTATE_SIZE:
+		return ftell(df->file) >= df->policy.value;
+	case ROTATE_RECORDS:
+		return df->policy.value > 0 && df->records >= df->policy.value;
+	}
+	return 0;
+}
+
+// Write a zone map for this data file. channels holds the names of the
+// n_channels values passed to data_file_zone_add. Call after the file
+// header is written.
+int data_file_zone_enable(DATA_FILE *df, char **channels, int n_channels,
+			  int block_records)
+{
+	char name[80];
+	int i;
+
+	if (n_channels > ZONE_MAX_CHANNELS)
+		return ARG_ERR;
+
+	snprintf(name, sizeof(name), "%s.idx", df->name);
+	df->zone_file = fopen(name, "w");
+	if (df->zone_file == NULL){
+		syslog(LOG_ERR, "Could not open %s\n", name);
+		return ERR;
+	}
+	df->zone_channels = n_channels;
+	df->zone_block_records = block_records;
+	df->zone.records = 0;
+	df->zone.offset = ftell(df->file);
+
+	fprintf(df->zone_file, "# FILE_TYPE  = ZONE_MAP_v1 \n");
+	fprintf(df->zone_file, "# data_file  = %s \n", df->name);
+	fprintf(df->zone_file, "# block_size = %d \n", block_records);
+	fprintf(df->zone_file, "#\n");
+	fprintf(df->zone_file, "offset; t_first; t_last; records; glitches");
+	for (i = 0; i < n_channels; i++)
+		fprintf(df->zone_file, "; %s_min; %s_max; %s_mean",
+			channels[i], channels[i], channels[i]);
+	fprintf(df->zone_file, "\n");
+
+	return OK;
+}
+
+// Write the summary of the current block to the zone map
+static void zone_write_block(DATA_FILE *df)
+{
+	ZONE_BLOCK *z = &df->zone;
+	long valid = z->records - z->glitches;
+	int i;
+
+	if (z->records == 0)
+		return;
+
+	fprintf(df->zone_file, "%ld; %.3f; %.3f; %ld; %ld",
+		z->offset, z->t_first, z->t_last, z->records, z->glitches);
+	for (i = 0; i < df->zone_channels; i++){
+		if (valid > 0)
+			fprintf(df->zone_file, "; %.1f; %.1f; %.1f",
+				z->min[i], z->max[i], z->sum[i]/valid);
+		else
+			fprintf(df->zone_file, "; 9999; 9999; 9999");
+	}
+	fprintf(df->zone_file, "\n");
+	z->records = 0;
+	z->offset = ftell(df->file);
+}
+
+// Add the values of one record to the zone map. values is NULL for a
+// record without valid data (glitch). Call after the record is written.
+int data_file_zone_add(DATA_FILE *df, double t, double *values)
+{
+	ZONE_BLOCK *z = &df->zone;
+	int i;
+
+	if (df->zone_file == NULL)
+		return OK;
+
+	// start a new block
+	if (z->records == 0){
+		z->t_first = t;
+		z->glitches = 0;
+		for (i = 0; i < df->zone_channels; i++){
+			z->min[i] = 1e30;
+			z->max[i] = -1e30;
+			z->sum[i] = 0;
+		}
+	}
+
+	z->t_last = t;
+	z->records++;
+	if (values == NULL){
+		z->glitches++;
+	}
+	else{
+		for (i = 0; i < df->zone_channels; i++){
+			if (values[i] < z->min[i]) z->min[i] = values[i];
+			if (values[i] > z->max[i]) z->max[i] = values[i];
+			z->sum[i] += values[i];
+		}
+	}
+
+	if (z->records >= df->zone_block_records)
+		zone_write_block(df);
+
+	return OK;
+}
+
+// Count a completely written record and write a checkpoint if due
+int data_file_record(DATA_FILE *df)
+{
+	df->records++;
+	if (df->records - df->records_ckpt >= CHECKPOINT_RECORDS)
+		return data_file_checkpoint(df);
+	return OK;
+}
+
+// Write a checkpoint marker and sync the file to disk. Everything in
+// front of a checkpoint marker survives a crash of the daemon or a
+// reset of the board.
+int data_file_checkpoint(DATA_FILE *df)
+{
+	fprintf(df->file, "%s %ld %ld\n", CHECKPOINT_MARKER,
+		df->records, (long)time(NULL));
+	df->records_ckpt = df->records;
+
+	if (fflush(df->file) != 0 || fdatasync(fileno(df->file)) != 0){
+		syslog(LOG_ERR, "Checkpoint of %s failed\n", df->name);
+		return ERR;
+	}
+	return OK;
+}
+
+// Close the data file and publish it to OUTBOX_DIR
+int data_file_close(DATA_FILE *df)
+{
+	char name[80];
+
+	if (df->file == NULL)
+		return ERR;
+
+	// finish zone map
+	if (df->zone_file != NULL){
+		zone_write_block(df);
+		fclose(df->zone_file);
+	}
+
+	// give back preallocated blocks that were not used
+	fflush(df->file);
+	if (ftruncate(fileno(df->file), ftell(df->file)) != 0)
+		syslog(LOG_NOTICE, "Could not truncate %s\n", df->name);
+
+	if (fclose(df->file) != 0)
+		syslog(LOG_ERR, "Error closing %s\n", df->name);
+	df->file = NULL;
+
+	// publish the zone map first, so that the index is never missing
+	// for a data file in the outbox
+	if (df->zone_file != NULL){
+		df->zone_file = NULL;
+		snprintf(name, sizeof(name), "%s.idx", df->name);
+		publish_file(name);
+	}
+
+	return publish_file(df->name);
+}
+
+// Slow loop, distrometer and fusion data files are compressed before
+// they are sent
+static int compress_on_publish(char *name)
+{
+	char *ext = strrchr(name, '.');
+
+	return (strncmp(name, "loop_", 5) == 0 || strncmp(name, "distro_", 7) == 0
+		|| strncmp(name, "fusion_", 7) == 0)
+	       && ext != NULL && strcmp(ext, ".dat") == 0;
+}
+
+// Copy src to dst, gzip compressed if compress is set
+static int copy_file(char *src, char *dst, int compress)
+{
+	char buf[64*1024];
+	int n;
+	int status = OK;
+	FILE *in;
+	gzFile gz = NULL;
+	FILE *out = NULL;
+
+	in = fopen(src, "r");
+	if (in == NULL)
+		return ERR;
+
+	if (compress)
+		gz = gzopen(dst, "wb");
+	else
+		out = fopen(dst, "w");
+	if (gz == NULL && out == NULL){
+		fclose(in);
+		return ERR;
+	}
+
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0){
+		if (compress){
+			if (gzwrite(gz, buf, n) != n)
+				status = ERR;
+		}
+		else{
+			if (fwrite(buf, 1, n, out) != n)
+				status = ERR;
+		}
+	}
+	fclose(in);
+
+	if (compress){
+		if (gzclose(gz) != Z_OK)
+			status = ERR;
+	}
+	else{
+		if (fflush(out) != 0 || fdatasync(fileno(out)) != 0)
+			status = ERR;
+		if (fclose(out) != 0)
+			status = ERR;
+	}
+	return status;
+}
+
+// Changed by the daemon if its config file names another outbox
+char outbox_dir[128] = OUTBOX_DIR;
+
+// Move a finished file to outbox_dir. It is written to a hidden
+// temporary name first and renamed when complete, so that the
+// uploader never sees half written files.
+int publish_file(char *name)
+{
+	char dst[256], tmp[256];
+	int compress = compress_on_publish(name);
+
+	if (compress){
+		snprintf(dst, sizeof(dst), "%s/%s.gz", outbox_dir, name);
+		snprintf(tmp, sizeof(tmp), "%s/.%s.gz.tmp", outbox_dir, name);
+	}
+	else{
+		snprintf(dst, sizeof(dst), "%s/%s", outbox_dir, name);
+		snprintf(tmp, sizeof(tmp), "%s/.%s.tmp", outbox_dir, name);
+
+		// cheap path if working dir and outbox are on the same fs
+		if (rename(name, dst) == 0)
+			return OK;
+	}
+
+	if (copy_file(name, tmp, compress) != OK){
+		syslog(LOG_ERR, "Could not publish %s\n", name);
+		unlink(tmp);
+		return ERR;
+	}
+	if (rename(tmp, dst) != 0){
+		syslog(LOG_ERR, "Could not rename %s\n", tmp);
+		unlink(tmp);
+		return ERR;
+	}
+	unlink(name);
+	return OK;
+}
+
+
+/*****************************/
+/* RECOVERY OF CRASHED FILES */
+/*****************************/
+
+// Truncate a text data file after its last complete line. Everything in
+// front of the last checkpoint marker was synced to disk. Lines after it
+// are kept while they are complete. A NUL byte is what the file system
+// leaves in blocks that were not written before a crash, the lines after
+// the last checkpoint cannot be trusted then and the file is truncated
+// to the checkpoint. The column header and comments are no records.
+// Returns the number of data records kept or -1 on error.
+static long recover_text_file(char *name)
+{
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	long pos = 0;
+	long good_end = 0, ckpt_end = 0;
+	long records = 0, ckpt_records = 0;
+	FILE *file = fopen(name, "r+");
+
+	if (file == NULL)
+		return -1;
+
+	while ((len = getline(&line, &size, file)) > 0){
+		if (memchr(line, '\0', len) != NULL){
+			good_end = ckpt_end;
+			records = ckpt_records;
+			break;
+		}
+		if (line[len - 1] != '\n')
+			break;		// last line was cut off
+		pos += len;
+		good_end = pos;
+		if (strncmp(line, CHECKPOINT_MARKER, strlen(CHECKPOINT_MARKER)) == 0){
+			ckpt_end = pos;
+			ckpt_records = records;
+		}
+		else if (line[0] != '#' && strncmp(line, "time;", 5) != 0)
+			records++;
+	}
+	free(line);
+
+	if (ftruncate(fileno(file), good_end) != 0){
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+
+	syslog(LOG_NOTICE, "Recovered %s: %ld records, %ld bytes\n",
+	       name, records, good_end);
+	return records;
+}
+
+// Truncate a binary I/Q file to its last complete record and correct
+// the number of records in the header.
+// Returns the number of records kept or -1 on error.
+static long recover_iq_binary(char *name)
+{
+	IQ_BIN_HEADER header;
+	long size, records;
+	int record_size = IQ_BIN_CHANNELS*3/2;
+	FILE *file = fopen(name, "r+");
+
+	if (file == NULL)
+		return -1;
+
+	if (fread(&header, sizeof(header), 1, file) != 1
+	    || strncmp(header.magic, IQ_BIN_MAGIC, sizeof(header.magic)) != 0){
+		fclose(file);
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	records = (size - header.header_size) / record_size;
+
+	if (records != header.N){
+		header.N = records;
+		rewind(file);
+		fwrite(&header, sizeof(header), 1, file);
+		fflush(file);
+		if (ftruncate(fileno(file), header.header_size
+					   + records*record_size) != 0){
+			fclose(file);
+			return -1;
+		}
+	}
+	fclose(file);
+
+	syslog(LOG_NOTICE, "Recovered %s: %ld records\n", name, records);
+	return records;
+}
+
+// Truncate a binary range profile or clutter map snapshot to its last
+// complete gate and correct n_gates in the header. Files of another
+// version are kept as they are.
+// Returns the number of gates kept or -1 on error.
+static long recover_gate_binary(char *name)
+{
+	RP_BIN_HEADER rp;
+	CM_BIN_HEADER cm;
+	int32_t *n_gates;
+	long size, records, header_size, record_size;
+	void *header;
+	FILE *file = fopen(name, "r+");
+
+	if (file == NULL)
+		return -1;
+
+	if (fread(&rp, sizeof(rp.magic), 1, file) != 1){
+		fclose(file);
+		return 0;
+	}
+	rewind(file);
+	if (strncmp(rp.magic, RP_BIN_MAGIC, sizeof(rp.magic)) == 0){
+		if (fread(&rp, sizeof(rp), 1, file) != 1){
+			fclose(file);
+			return 0;
+		}
+		if (rp.version != RP_BIN_VERSION){
+			fclose(file);
+			return 1;
+		}
+		header = &rp;
+		header_size = sizeof(rp);
+		n_gates = &rp.n_gates;
+		record_size = rp.residual ? sizeof(RP_RESIDUAL_GATE) : sizeof(RP_GATE);
+	}
+	else if (strncmp(rp.magic, CM_BIN_MAGIC, sizeof(cm.magic)) == 0){
+		if (fread(&cm, sizeof(cm), 1, file) != 1){
+			fclose(file);
+			return 0;
+		}
+		if (cm.version != CM_BIN_VERSION){
+			fclose(file);
+			return 1;
+		}
+		header = &cm;
+		header_size = sizeof(cm);
+		n_gates = &cm.n_gates;
+		record_size = sizeof(int32_t) + 2*RP_RECEIVERS*sizeof(float);
+	}
+	else{
+		fclose(file);
+		return 0;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	records = (size - header_size) / record_size;
+
+	if (records != *n_gates){
+		*n_gates = records;
+		rewind(file);
+		fwrite(header, header_size, 1, file);
+		fflush(file);
+		if (ftruncate(fileno(file), header_size + records*record_size) != 0){
+			fclose(file);
+			return -1;
+		}
+	}
+	fclose(file);
+
+	syslog(LOG_NOTICE, "Recovered %s: %ld gates\n", name, records);
+	return records;
+}
+
+// Check if name looks like a data file written by attrracd,
+// e.g. loop_20100709_1200.dat, or its zone map
+static int is_data_file(char *name)
+{
+	char *prefix[] = {"loop_", "loop_calibration_", "iq_", "radar_",
+			  "clutter_", "distro_", "fusion_"};
+	int n_prefix = sizeof(prefix)/sizeof(prefix[0]);
+	int i, len;
+	char *ext = strrchr(name, '.');
+
+	if (ext == NULL || (strcmp(ext, ".dat") != 0 && strcmp(ext, ".bin") != 0
+			    && strcmp(ext, ".idx") != 0))
+		return 0;
+
+	for (i = 0; i < n_prefix; i++){
+		len = strlen(prefix[i]);
+		if (strncmp(name, prefix[i], len) == 0
+		    && name[len] >= '0' && name[len] <= '9')
+			return 1;
+	}
+	return 0;
+}
+
+// Truncate all data files in dir that were left behind by a crash to
+// their last complete record and publish what could be salvaged.
+// Files without any complete record are deleted.
+int recover_data_files(char *dir)
+{
+	DIR *d;
+	struct dirent *entry;
+	char *ext;
+	long records;
+
+	d = opendir(dir);
+	if (d == NULL){
+		syslog(LOG_ERR, "Could not open %s for recovery\n", dir);
+		return ERR;
+	}
+
+	while ((entry = readdir(d)) != NULL){
+		if (!is_data_file(entry->d_name))
+			continue;
+
+		// zone maps of crashed files are incomplete, they are
+		// dropped and the data file is published without one
+		ext = strrchr(entry->d_name, '.');
+		if (strcmp(ext, ".idx") == 0){
+			unlink(entry->d_name);
+			continue;
+		}
+
+		if (strcmp(ext, ".bin") == 0 && strncmp(entry->d_name, "iq_", 3) == 0)
+			records = recover_iq_binary(entry->d_name);
+		else if (strcmp(ext, ".bin") == 0)
+			records = recover_gate_binary(entry->d_name);
+		else
+			records = recover_text_file(entry->d_name);
+
+		if (records > 0)
+			publish_file(entry->d_name);
+		else if (records == 0)
+			unlink(entry->d_name);
+	}
+	closedir(d);
+
+	return OK;
+}
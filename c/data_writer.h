@@ -0,0 +1,284 @@
+#ifndef DATA_WRITER_H
+#define DATA_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "usb_control.h"
+
+// Output formats for burst I/Q dumps (command "start") and range
+// profiles (command "radar")
+#define IQ_FORMAT_TEXT		0
+#define IQ_FORMAT_BINARY	1
+
+// Size of the buffer the text formatter fills before it is written
+// to the file in one go
+#define WRITE_BUF_SIZE		(256*1024)
+
+// Magic and version of the packed binary I/Q format
+#define IQ_BIN_MAGIC		"ATTRRIQ"
+#define IQ_BIN_VERSION		1
+#define IQ_BIN_CHANNELS		8
+
+// Header of a packed binary I/Q file. It is followed by N records of
+// 8 channels x 12 bit = 12 bytes. Channel order is the same as in the
+// text format: 35_H_I 35_H_Q 22_H_I 22_H_Q 35_V_I 35_V_Q 22_V_I 22_V_Q.
+// Two 12 bit values a,b are packed into three bytes:
+//	byte 0: a[7..0]
+//	byte 1: b[3..0] a[11..8]
+//	byte 2: b[11..4]
+// The values are the raw two's complement ADC codes, i.e. the ADC
+// offsets stored in the header have to be added to get the values of
+// the text format. All header fields are little endian.
+typedef struct{
+	char	magic[8];		// IQ_BIN_MAGIC
+	int32_t	version;		// IQ_BIN_VERSION
+	int32_t	header_size;		// sizeof(IQ_BIN_HEADER)
+	int64_t	t_sec;			// time of burst (UTC)
+	int32_t	t_usec;
+	int32_t	N;			// number of records
+	int32_t	n_channels;		// IQ_BIN_CHANNELS
+	int32_t	n_samples;		// PULSE_CONF snapshot
+	int32_t	pw;
+	int32_t	delay;
+	int32_t	pol_preced;
+	int32_t	adc_delay;
+	int32_t	mode;
+	int32_t	atten22_1;
+	int32_t	atten22_2;
+	int32_t	atten35_1;
+	int32_t	atten35_2;
+	int32_t	adc_offset[4];		// I_35 Q_35 I_22 Q_22
+	int32_t	reserved;
+} IQ_BIN_HEADER;
+
+// Range profile of a radar sweep (command "radar"): mean and standard
+// deviation of amplitude and phase of each channel per range gate,
+// channels 35_H_A 35_H_P 22_H_A 22_H_P 35_V_A 35_V_P 22_V_A 22_V_P
+#define RP_CHANNELS		8
+#define RP_MAX_GATES		256
+
+// With coherent integration the I/Q samples of each receiver (35_H 22_H
+// 35_V 22_V) are averaged before the magnitude is taken, which pulls
+// weak echoes out of the noise with fewer samples
+#define RP_RECEIVERS		4
+#define RP_INCOHERENT		0	// mean and std_dev only
+#define RP_COHERENT		1	// and the coherent mean with its SNR
+#define RP_COHERENT_DRIFT	2	// phase drift over the dwell removed
+
+typedef struct{
+	int32_t	delay;
+	int32_t	N;			// samples per polarization
+	float	mean[RP_CHANNELS];
+	float	std_dev[RP_CHANNELS];
+	float	coh_amp[RP_RECEIVERS];	// 0 for RP_INCOHERENT
+	float	coh_phase[RP_RECEIVERS];	// degrees
+	float	snr[RP_RECEIVERS];	// dB
+} RP_GATE;
+
+typedef struct{
+	struct timeval	tim;		// start of the sweep
+	PULSE_CONF	conf;		// delay is the one of each gate
+	int		integration;	// RP_INCOHERENT ...
+	int		residual;	// coherent means are minus the clutter map
+	int		n_gates;
+	RP_GATE		gate[RP_MAX_GATES];
+} RANGE_PROFILE;
+
+// A residual profile only keeps what is left of each gate after the
+// clutter map is subtracted from its coherent means
+typedef struct{
+	int32_t	delay;
+	int32_t	N;
+	float	amp[RP_RECEIVERS];
+	float	phase[RP_RECEIVERS];	// degrees
+	float	snr[RP_RECEIVERS];	// dB, residual against the noise
+} RP_RESIDUAL_GATE;
+
+// Magic and version of the binary range profile format
+#define RP_BIN_MAGIC		"ATTRRRP"
+#define RP_BIN_VERSION		3
+
+// Header of a binary range profile file, followed by n_gates RP_GATE
+// records of 120 bytes, or RP_RESIDUAL_GATE records of 56 bytes if
+// residual is set. Little endian like IQ_BIN_HEADER.
+typedef struct{
+	char	magic[8];		// RP_BIN_MAGIC
+	int32_t	version;		// RP_BIN_VERSION
+	int32_t	header_size;		// sizeof(RP_BIN_HEADER)
+	int64_t	t_sec;			// start of the sweep (UTC)
+	int32_t	t_usec;
+	int32_t	n_gates;
+	int32_t	n_channels;		// RP_CHANNELS
+	int32_t	n_samples;		// PULSE_CONF snapshot
+	int32_t	pw;
+	int32_t	pol_preced;
+	int32_t	adc_delay;
+	int32_t	mode;
+	int32_t	atten22_1;
+	int32_t	atten22_2;
+	int32_t	atten35_1;
+	int32_t	atten35_2;
+	int32_t	integration;		// RP_INCOHERENT ...
+	int32_t	residual;
+} RP_BIN_HEADER;
+
+// Clutter map: the coherent mean of each gate and receiver in clear
+// air, updated as an exponential moving average. It holds for the
+// pulse configuration conf only.
+typedef struct{
+	PULSE_CONF	conf;
+	double		alpha;		// weight of a new sweep
+	long		updates;	// sweeps merged into the map
+	int		n_gates;
+	int		delay[RP_MAX_GATES];
+	double		re[RP_MAX_GATES][RP_RECEIVERS];
+	double		im[RP_MAX_GATES][RP_RECEIVERS];
+} CLUTTER_MAP;
+
+#define CM_BIN_MAGIC		"ATTRRCM"
+#define CM_BIN_VERSION		1
+
+// Header of a binary clutter map snapshot, followed by n_gates records
+// of int32 delay and float I, Q for each receiver (36 bytes)
+typedef struct{
+	char	magic[8];		// CM_BIN_MAGIC
+	int32_t	version;		// CM_BIN_VERSION
+	int32_t	header_size;		// sizeof(CM_BIN_HEADER)
+	int64_t	t_sec;			// time of the snapshot (UTC)
+	int32_t	n_gates;
+	int32_t	n_receivers;		// RP_RECEIVERS
+	int32_t	updates;
+	float	alpha;
+} CM_BIN_HEADER;
+
+// Number of records after which a checkpoint marker is written and the
+// file is synced to disk
+#define CHECKPOINT_RECORDS	100
+
+// Checkpoint marker line in text data files:
+// "# CHECKPOINT <records> <unix time>"
+#define CHECKPOINT_MARKER	"# CHECKPOINT"
+
+// File rotation modes
+#define ROTATE_TIME		0	// new file every 'value' seconds (aligned to UTC)
+#define ROTATE_SIZE		1	// new file after 'value' bytes
+#define ROTATE_RECORDS		2	// new file after 'value' records
+
+// Policy for starting a new data file. 'prealloc' bytes are reserved
+// with fallocate when a file is opened, so that a file growing slowly
+// on flash gets contiguous blocks. For ROTATE_SIZE the file size is
+// preallocated if prealloc is 0.
+typedef struct rotate_policy{
+	int	mode;
+	long	value;
+	long	prealloc;
+} ROTATE_POLICY;
+
+// Zone map: summary of each block of records, written to a sidecar
+// file <name>.idx which is published together with the data file.
+// Queries can read the small index to find the interesting blocks
+// instead of decompressing every data file.
+#define ZONE_MAX_CHANNELS	16
+#define ZONE_BLOCK_RECORDS	200	// 10 s of slow loop at 20 Hz
+
+typedef struct{
+	long	offset;			// byte offset of the block in the data file
+	double	t_first;		// time range of the block
+	double	t_last;
+	long	records;		// records in block, including glitches
+	long	glitches;		// records without valid data
+	double	min[ZONE_MAX_CHANNELS];
+	double	max[ZONE_MAX_CHANNELS];
+	double	sum[ZONE_MAX_CHANNELS];
+} ZONE_BLOCK;
+
+// A data file that is written record by record. Checkpoint markers
+// are written every CHECKPOINT_RECORDS records, so that a file which
+// was not closed properly can be recovered on startup. When the file
+// is closed it is published to OUTBOX_DIR.
+typedef struct{
+	FILE	*file;
+	char	name[64];		// name of the file in the working dir
+	long	records;		// number of records written
+	long	records_ckpt;		// number of records at last checkpoint
+	ROTATE_POLICY policy;		// when to start a new file
+	time_t	rotate_at;		// for ROTATE_TIME: time of next rotation
+	FILE	*zone_file;		// zone map sidecar, NULL if disabled
+	int	zone_channels;
+	int	zone_block_records;
+	ZONE_BLOCK zone;		// block currently being summarized
+} DATA_FILE;
+
+// Write integer v right aligned in a field of at least 'width' chars
+// (same output as printf("%*d")). Returns number of chars written.
+int fmt_int(char *p, int v, int width);
+
+// Write burst I/Q data as text, one line per record, the same way
+// fprintf("%6d ...") did but formatted into a large buffer
+int write_iq_text(FILE *file, DATA_STRUCT *data);
+
+// Write burst I/Q data in the packed binary format
+int write_iq_binary(FILE *file, DATA_STRUCT *data, PULSE_CONF *conf,
+		    struct timeval *tim);
+
+// Open filename, write the burst in the given format and close it
+int write_iq_burst(char *filename, DATA_STRUCT *data, PULSE_CONF *conf,
+		   struct timeval *tim, int format);
+
+// Open filename, write the range profile as text (one line per gate)
+// or binary and close it
+int write_range_profile(char *filename, RANGE_PROFILE *rp, int format);
+
+// Open filename, write a snapshot of the clutter map as text (one line
+// per gate) or binary and close it
+int write_clutter_map(char *filename, CLUTTER_MAP *cm, time_t t, int format);
+
+// Parse a rotation policy, e.g. "TIME" "600" or "SIZE" "1000000"
+int parse_rotate_policy(ROTATE_POLICY *policy, char *mode, char *value);
+
+// Build a timestamped file name prefix_YYYYmmdd_HHMM[SS].dat. Seconds
+// are only added if files can be started within the same minute. If the
+// name is taken in the working dir or the outbox, _<n> is appended.
+void data_file_name(char *name, int size, char *prefix, time_t t,
+		    ROTATE_POLICY *policy);
+
+// Open a new data file for writing. policy may be NULL if the file is
+// never rotated.
+int data_file_open(DATA_FILE *df, char *name, ROTATE_POLICY *policy);
+
+// Check if the rotation policy asks for a new file
+int data_file_rotate_due(DATA_FILE *df, time_t now);
+
+// Write a zone map for this data file. channels holds the names of the
+// n_channels values passed to data_file_zone_add. Call after the file
+// header is written.
+int data_file_zone_enable(DATA_FILE *df, char **channels, int n_channels,
+			  int block_records);
+
+// Add the values of one record to the zone map. values is NULL for a
+// record without valid data (glitch). Call after the record is written.
+int data_file_zone_add(DATA_FILE *df, double t, double *values);
+
+// Count a completely written record and write a checkpoint if due
+int data_file_record(DATA_FILE *df);
+
+// Write a checkpoint marker and sync the file to disk
+int data_file_checkpoint(DATA_FILE *df);
+
+// Close the data file and publish it to OUTBOX_DIR
+int data_file_close(DATA_FILE *df);
+
+// Directory the finished files are published to, OUTBOX_DIR by default
+extern char outbox_dir[128];
+
+// Move a finished file to outbox_dir. Slow loop files are gzipped on
+// the way. The file only appears in outbox_dir when it is complete.
+int publish_file(char *name);
+
+// Truncate all data files in dir that were left behind by a crash to
+// their last complete record and publish what could be salvaged
+int recover_data_files(char *dir);
+
+#endif /* DATA_WRITER_H */
@@ -0,0 +1,166 @@
+/*
+ * device.c - Owner thread for the USB device
+ */
+
+#include <stdio.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "usb_control.h"
+#include "device.h"
+
+typedef struct{
+	device_op	op;
+	void		*arg;
+	int		*status;	// NULL if nobody waits for the result
+	int		*done;
+} DEVICE_REQ;
+
+static DEVICE_REQ queue[DEVICE_QUEUE_LEN];
+static int head = 0;
+static volatile int n_queued = 0;
+static int holds = 0;
+
+static FT_HANDLE handle;
+static pthread_t owner_thread;
+static pthread_mutex_t device_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queued_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+/* Take the oldest request and run it. Called with the lock held. */
+static void run_next(void)
+{
+	DEVICE_REQ req = queue[head];
+	int status;
+
+	head = (head + 1) % DEVICE_QUEUE_LEN;
+	n_queued--;
+	pthread_mutex_unlock(&device_lock);
+
+	status = req.op(handle, req.arg);
+
+	pthread_mutex_lock(&device_lock);
+	if (req.done != NULL){
+		*req.status = status;
+		*req.done = 1;
+		pthread_cond_broadcast(&done_cond);
+	}
+}
+
+static void *owner(void *args)
+{
+	pthread_mutex_lock(&device_lock);
+	while (1){
+		while (n_queued == 0)
+			pthread_cond_wait(&queued_cond, &device_lock);
+		run_next();
+	}
+	return NULL;
+}
+
+int device_init(FT_HANDLE ftHandle)
+{
+	handle = ftHandle;
+	if (pthread_create(&owner_thread, NULL, owner, NULL) != 0)
+		return ERR;
+	pthread_detach(owner_thread);
+	return OK;
+}
+
+static int enqueue(device_op op, void *arg, int *status, int *done)
+{
+	DEVICE_REQ *req;
+
+	if (n_queued == DEVICE_QUEUE_LEN){
+		syslog(LOG_NOTICE, "Device queue full\n");
+		return ERR;
+	}
+	req = &queue[(head + n_queued) % DEVICE_QUEUE_LEN];
+	req->op = op;
+	req->arg = arg;
+	req->status = status;
+	req->done = done;
+	n_queued++;
+	pthread_cond_signal(&queued_cond);
+	return OK;
+}
+
+int device_call(device_op op, void *arg)
+{
+	DEVICE_WAIT w;
+
+	if (device_start(op, arg, &w) != OK)
+		return ERR;
+	return device_wait(&w);
+}
+
+int device_start(device_op op, void *arg, DEVICE_WAIT *w)
+{
+	int status;
+
+	w->done = 0;
+	if (pthread_equal(pthread_self(), owner_thread)){
+		w->status = op(handle, arg);
+		w->done = 1;
+		return OK;
+	}
+
+	pthread_mutex_lock(&device_lock);
+	status = enqueue(op, arg, &w->status, &w->done);
+	pthread_mutex_unlock(&device_lock);
+	return status;
+}
+
+int device_wait(DEVICE_WAIT *w)
+{
+	pthread_mutex_lock(&device_lock);
+	while (!w->done)
+		pthread_cond_wait(&done_cond, &device_lock);
+	pthread_mutex_unlock(&device_lock);
+	return w->status;
+}
+
+int device_submit(device_op op, void *arg)
+{
+	int status;
+
+	pthread_mutex_lock(&device_lock);
+	status = enqueue(op, arg, NULL, NULL);
+	pthread_mutex_unlock(&device_lock);
+	return status;
+}
+
+int device_pending(void)
+{
+	return n_queued > 0;
+}
+
+void device_serve(void)
+{
+	if (!pthread_equal(pthread_self(), owner_thread))
+		return;
+
+	pthread_mutex_lock(&device_lock);
+	while (n_queued > 0 || holds > 0){
+		if (n_queued == 0)
+			pthread_cond_wait(&queued_cond, &device_lock);
+		else
+			run_next();
+	}
+	pthread_mutex_unlock(&device_lock);
+}
+
+void device_hold(void)
+{
+	pthread_mutex_lock(&device_lock);
+	holds++;
+	pthread_mutex_unlock(&device_lock);
+}
+
+void device_release(void)
+{
+	pthread_mutex_lock(&device_lock);
+	holds--;
+	pthread_cond_broadcast(&queued_cond);
+	pthread_mutex_unlock(&device_lock);
+}
@@ -0,0 +1,52 @@
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "ftd2xx.h"
+
+// All I/O on the USB device runs on one owner thread. Other threads hand
+// it operations through a queue. A long running operation like the slow
+// loop keeps the thread and runs the queued operations between two of
+// its records with device_serve, so their bytes never interleave.
+#define DEVICE_QUEUE_LEN	32
+
+typedef int (*device_op)(FT_HANDLE ftHandle, void *arg);
+
+// Start the owner thread for ftHandle
+int device_init(FT_HANDLE ftHandle);
+
+// Run op on the owner thread and wait for it. Returns the status of op,
+// ERR if the queue is full. Called on the owner thread, op runs at once.
+int device_call(device_op op, void *arg);
+
+// Queue op without waiting for it, e.g. the slow loop. arg must stay
+// valid until op has finished.
+int device_submit(device_op op, void *arg);
+
+// Queue op and wait for it later with device_wait, so the caller can
+// work on the result of the previous op meanwhile. w and arg must stay
+// valid until device_wait has returned.
+typedef struct{
+	int	status;
+	int	done;
+} DEVICE_WAIT;
+
+int device_start(device_op op, void *arg, DEVICE_WAIT *w);
+
+// Wait for an op of device_start, returns its status
+int device_wait(DEVICE_WAIT *w);
+
+// 1 if operations are waiting, cheap enough to check after every record
+int device_pending(void);
+
+// Run the waiting operations. Only for operations running on the owner
+// thread, the device has to be ready for commands. Does not return while
+// the device is held.
+void device_serve(void);
+
+// Keep the long running operation paused from its next pause until
+// device_release, so a series of operations (a radar sweep) runs without
+// its records in between. Every device_hold needs its device_release.
+void device_hold(void);
+void device_release(void);
+
+#endif /* DEVICE_H */
@@ -0,0 +1,173 @@
+/*
+ * distrometer.c - Read telegrams of the distrometer from the serial port
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/time.h>
+
+#include "usb_control.h"
+#include "data_writer.h"
+#include "distrometer.h"
+#include "fusion.h"
+
+int distro_keep_running = 0;
+
+// Set while a reader thread owns the serial port and the buffers, taken
+// with compare and swap so that two starts cannot both get it
+static int distro_active = 0;
+
+// Open the serial port in raw mode. The baud rate set up by the system
+// is kept.
+static int open_serial(char *device)
+{
+	struct termios tio;
+	int fd;
+
+	fd = open(device, O_RDWR | O_NOCTTY);
+	if (fd < 0){
+		syslog(LOG_ERR, "Could not open %s\n", device);
+		return -1;
+	}
+	if (tcgetattr(fd, &tio) == 0){
+		cfmakeraw(&tio);
+		tio.c_cc[VMIN] = 1;
+		tio.c_cc[VTIME] = 0;
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	tcflush(fd, TCIFLUSH);
+	return fd;
+}
+
+// Write one telegram as a single line. Line breaks inside the telegram
+// become blanks, the same as the shell script did with "echo $DATA".
+static void write_telegram(DATA_FILE *df, struct timeval *tim,
+			   char *telegram, int len)
+{
+	int i;
+
+	for (i = 0; i < len; i++)
+		if (telegram[i] == '\r' || telegram[i] == '\n')
+			telegram[i] = ' ';
+
+	fprintf(df->file, "%ld.%03ld; ", tim->tv_sec, tim->tv_usec/1000);
+	fwrite(telegram, 1, len, df->file);
+	fputc('\n', df->file);
+	data_file_record(df);
+
+	fusion_add_telegram(tim->tv_sec + tim->tv_usec/1e6, telegram, len);
+}
+
+int claim_distrometer(void)
+{
+	// a reader that was just stopped may still be closing its file
+	if (!__sync_bool_compare_and_swap(&distro_active, 0, 1)){
+		syslog(LOG_NOTICE, "Distrometer is already running\n");
+		return ERR;
+	}
+	return OK;
+}
+
+void release_distrometer(void)
+{
+	__sync_lock_release(&distro_active);
+}
+
+void *start_distrometer(void *args)
+{
+	struct distro_args *a = (struct distro_args*) args;
+	unsigned char buf[DISTRO_READ_SIZE];
+	char *telegram = malloc(DISTRO_MAX_TELEGRAM);
+	int len = 0, in_frame = 0;
+	struct timeval tim, t_start;
+	struct pollfd pfd;
+	char filename[64];
+	DATA_FILE distro_file;
+	time_t t_now;
+	ssize_t n;
+	int i, fd;
+
+	if ((fd = open_serial(a->device)) < 0){
+		free(telegram);
+		release_distrometer();
+		return NULL;
+	}
+	distro_keep_running = 1;
+
+	time(&t_now);
+	data_file_name(filename, sizeof(filename), "distro_", t_now, a->rotation);
+	data_file_open(&distro_file, filename, a->rotation);
+
+	syslog(LOG_NOTICE, "Starting distrometer on %s\n", a->device);
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (distro_keep_running == 1){
+		// open new file as requested by the rotation policy
+		time(&t_now);
+		if (data_file_rotate_due(&distro_file, t_now)){
+			data_file_close(&distro_file);
+			data_file_name(filename, sizeof(filename), "distro_", t_now, a->rotation);
+			data_file_open(&distro_file, filename, a->rotation);
+		}
+
+		// wake up every second to check the flag and the rotation
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+		n = read(fd, buf, sizeof(buf));
+		if (n <= 0){
+			syslog(LOG_ERR, "Read from %s failed\n", a->device);
+			sleep(1);
+			continue;
+		}
+		gettimeofday(&tim, NULL);
+
+		for (i = 0; i < n; i++){
+			if (buf[i] == DISTRO_STX){
+				// telegram is stamped with the time it started
+				if (in_frame)
+					syslog(LOG_NOTICE, "Distrometer: telegram without ETX\n");
+				in_frame = 1;
+				len = 0;
+				t_start = tim;
+			}
+			else if (!in_frame){
+				continue;
+			}
+			else if (buf[i] == DISTRO_ETX){
+				write_telegram(&distro_file, &t_start, telegram, len);
+				in_frame = 0;
+			}
+			else if (len < DISTRO_MAX_TELEGRAM){
+				telegram[len++] = buf[i];
+			}
+			else{
+				syslog(LOG_NOTICE, "Distrometer: telegram too long\n");
+				in_frame = 0;
+			}
+		}
+	}
+
+	syslog(LOG_NOTICE, "Distrometer stopped\n");
+
+	data_file_close(&distro_file);
+	close(fd);
+	free(telegram);
+	release_distrometer();
+
+	return NULL;
+}
+
+int stop_distrometer(void)
+{
+	// set flag to stop the read loop and make thread to return
+	distro_keep_running = 0;
+
+	return OK;
+}
@@ -0,0 +1,43 @@
+#ifndef DISTROMETER_H
+#define DISTROMETER_H
+
+#include "data_writer.h"
+
+/////////////
+// GLOBALS //
+/////////////
+
+extern int distro_keep_running;
+
+// Serial port of the distrometer (COM2)
+#define DISTRO_DEVICE		"/dev/ttyS1"
+
+// A telegram is framed by STX ... ETX
+#define DISTRO_STX		0x02
+#define DISTRO_ETX		0x03
+#define DISTRO_MAX_TELEGRAM	4096
+
+// Size of the buffer for bulk reads from the serial port
+#define DISTRO_READ_SIZE	1024
+
+// Arguments for the distrometer thread
+struct distro_args{
+	char		*device;
+	ROTATE_POLICY	*rotation;
+};
+
+// Take the distrometer for a new reader thread. Returns ERR if a reader
+// is still running. release_distrometer gives it back if the thread
+// could not be started.
+int claim_distrometer(void);
+void release_distrometer(void);
+
+// Read telegrams from the distrometer as long as distro_keep_running
+// is true and write them to distro_*.dat files, one line per telegram:
+// "<unix time with ms>; <telegram>". Has to be claimed first, the
+// thread releases the distrometer when it ends.
+void *start_distrometer(void *args);
+
+int stop_distrometer(void);
+
+#endif /* DISTROMETER_H */
@@ -0,0 +1,237 @@
+/*
+ * fusion.c - Time aligned product of radar and distrometer data
+ *
+ * The slow loop records are averaged to one second. Each second is
+ * written together with the distrometer telegram nearest in time, in
+ * time order. Both sources are fed from their own threads.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "usb_control.h"
+#include "data_writer.h"
+#include "distrometer.h"
+#include "fusion.h"
+
+typedef struct{
+	long	sec;
+	int	n;			// records, including glitches
+	int	glitches;
+	double	sum[FUSION_CHANNELS];
+} FUSION_SECOND;
+
+typedef struct{
+	double	t;
+	int	len;
+	char	text[DISTRO_MAX_TELEGRAM];
+} FUSION_TELEGRAM;
+
+static pthread_mutex_t fusion_lock = PTHREAD_MUTEX_INITIALIZER;
+static int fusion_running = 0;
+static ROTATE_POLICY *fusion_rotation;
+static DATA_FILE fusion_file;
+
+// radar seconds sorted by time
+static FUSION_SECOND pending[FUSION_MAX_PENDING];
+static int n_pending;
+static long last_written;		// newest second written
+static long late;			// records dropped, second already written
+
+// telegrams sorted by time
+static FUSION_TELEGRAM telegrams[FUSION_MAX_TELEGRAMS];
+static int n_telegrams;
+
+static void open_fusion_file(void)
+{
+	char filename[64];
+	time_t t_now;
+
+	time(&t_now);
+	data_file_name(filename, sizeof(filename), "fusion_", t_now, fusion_rotation);
+	data_file_open(&fusion_file, filename, fusion_rotation);
+
+	fprintf(fusion_file.file, "# FILE_TYPE  = FUSION_v1 \n");
+	fprintf(fusion_file.file, "# radar      = 1 s means of slow loop records \n");
+	fprintf(fusion_file.file, "# distro     = nearest telegram within %d s, "
+				  "dt = t_distro - t \n", FUSION_MAX_DT);
+	fprintf(fusion_file.file, "#\n");
+	fprintf(fusion_file.file, "time;         n; glitch;  I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
+				  "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
+				  "A_h_35;  A_h_22;  A_v_35;  A_v_22;  "
+				  "T_case;   T_pcb;      dt; distro\n");
+}
+
+/* Write the oldest pending second with its nearest telegram */
+static void write_oldest(void)
+{
+	FUSION_SECOND *s = &pending[0];
+	FUSION_TELEGRAM *nearest = NULL;
+	double t = s->sec + 0.5;
+	int valid = s->n - s->glitches;
+	int i;
+
+	for (i = 0; i < n_telegrams; i++){
+		if (fabs(telegrams[i].t - t) > FUSION_MAX_DT)
+			continue;
+		if (nearest == NULL || fabs(telegrams[i].t - t) < fabs(nearest->t - t))
+			nearest = &telegrams[i];
+	}
+
+	if (data_file_rotate_due(&fusion_file, time(NULL))){
+		data_file_close(&fusion_file);
+		open_fusion_file();
+	}
+
+	fprintf(fusion_file.file, "%ld; % 3d; % 3d", s->sec, s->n, s->glitches);
+	for (i = 0; i < FUSION_CHANNELS; i++){
+		if (valid > 0)
+			fprintf(fusion_file.file, "; % 7.1f", s->sum[i]/valid);
+		else
+			fprintf(fusion_file.file, ";    9999");
+	}
+	if (nearest != NULL){
+		fprintf(fusion_file.file, "; % 7.1f; ", nearest->t - t);
+		fwrite(nearest->text, 1, nearest->len, fusion_file.file);
+		fputc('\n', fusion_file.file);
+	}
+	else{
+		fprintf(fusion_file.file, ";    9999; -\n");
+	}
+	data_file_record(&fusion_file);
+
+	last_written = s->sec;
+	n_pending--;
+	memmove(&pending[0], &pending[1], n_pending*sizeof(FUSION_SECOND));
+
+	// a telegram followed by one that is not later than the next
+	// second can not be the nearest any more
+	t = last_written + 1.5;
+	while (n_telegrams > 1 && telegrams[1].t <= t){
+		n_telegrams--;
+		memmove(&telegrams[0], &telegrams[1], n_telegrams*sizeof(FUSION_TELEGRAM));
+	}
+}
+
+/* Write all seconds that are complete and whose nearest telegram is
+ * known. A second is complete when records of a later second arrived.
+ * force writes all. */
+static void flush(int force)
+{
+	double t_telegram = n_telegrams ? telegrams[n_telegrams - 1].t : 0;
+	long span;
+
+	while (n_pending > 0){
+		span = pending[n_pending - 1].sec - pending[0].sec;
+		if (!force && (span == 0 || (t_telegram < pending[0].sec + 0.5
+					     && span < FUSION_MAX_DELAY)))
+			break;
+		write_oldest();
+	}
+}
+
+int fusion_start(ROTATE_POLICY *rotation)
+{
+	pthread_mutex_lock(&fusion_lock);
+	if (!fusion_running){
+		fusion_rotation = rotation;
+		n_pending = 0;
+		n_telegrams = 0;
+		last_written = 0;
+		late = 0;
+		open_fusion_file();
+		fusion_running = 1;
+		syslog(LOG_NOTICE, "Fusion started\n");
+	}
+	pthread_mutex_unlock(&fusion_lock);
+	return OK;
+}
+
+int fusion_stop(void)
+{
+	pthread_mutex_lock(&fusion_lock);
+	if (fusion_running){
+		flush(1);
+		data_file_close(&fusion_file);
+		fusion_running = 0;
+		syslog(LOG_NOTICE, "Fusion stopped, %ld late records dropped\n", late);
+	}
+	pthread_mutex_unlock(&fusion_lock);
+	return OK;
+}
+
+void fusion_add_radar(double t, double *values)
+{
+	FUSION_SECOND *s;
+	long sec = (long) floor(t);
+	int i, j;
+
+	pthread_mutex_lock(&fusion_lock);
+	if (!fusion_running || sec <= last_written){
+		if (fusion_running)
+			late++;
+		pthread_mutex_unlock(&fusion_lock);
+		return;
+	}
+
+	// find the second, records come in order so search from the end
+	for (i = n_pending - 1; i >= 0 && pending[i].sec > sec; i--);
+	if (i < 0 || pending[i].sec != sec){
+		// buffer full: the oldest second is written without waiting
+		if (n_pending == FUSION_MAX_PENDING){
+			write_oldest();
+			if (sec <= last_written){
+				late++;
+				pthread_mutex_unlock(&fusion_lock);
+				return;
+			}
+			i--;
+		}
+		// new second behind index i
+		i++;
+		memmove(&pending[i + 1], &pending[i], (n_pending - i)*sizeof(FUSION_SECOND));
+		n_pending++;
+		memset(&pending[i], 0, sizeof(FUSION_SECOND));
+		pending[i].sec = sec;
+	}
+	s = &pending[i];
+
+	s->n++;
+	if (values == NULL)
+		s->glitches++;
+	else
+		for (j = 0; j < FUSION_CHANNELS; j++)
+			s->sum[j] += values[j];
+
+	flush(0);
+	pthread_mutex_unlock(&fusion_lock);
+}
+
+void fusion_add_telegram(double t, char *telegram, int len)
+{
+	int i;
+
+	pthread_mutex_lock(&fusion_lock);
+	if (!fusion_running){
+		pthread_mutex_unlock(&fusion_lock);
+		return;
+	}
+
+	// buffer full: drop the oldest telegram
+	if (n_telegrams == FUSION_MAX_TELEGRAMS){
+		n_telegrams--;
+		memmove(&telegrams[0], &telegrams[1], n_telegrams*sizeof(FUSION_TELEGRAM));
+	}
+	for (i = n_telegrams; i > 0 && telegrams[i - 1].t > t; i--)
+		telegrams[i] = telegrams[i - 1];
+	telegrams[i].t = t;
+	telegrams[i].len = len;
+	memcpy(telegrams[i].text, telegram, len);
+	n_telegrams++;
+
+	flush(0);
+	pthread_mutex_unlock(&fusion_lock);
+}
@@ -0,0 +1,31 @@
+#ifndef FUSION_H
+#define FUSION_H
+
+#include "data_writer.h"
+
+// Radar values per second of the fusion product, the same channels as
+// the zone map of the slow loop: 8 I/Q means, 4 amplitudes, T_case, T_pcb
+#define FUSION_CHANNELS		14
+
+// Reorder buffer: a radar second is written when a distrometer telegram
+// later than it has arrived, so that the nearest telegram is known, or
+// when it is FUSION_MAX_DELAY s older than the newest radar second.
+#define FUSION_MAX_PENDING	128	// radar seconds waiting for a telegram
+#define FUSION_MAX_DELAY	90	// s, distrometer sends once a minute
+#define FUSION_MAX_TELEGRAMS	4
+#define FUSION_MAX_DT		60	// s, farther telegrams are not used
+
+// Start writing fusion_*.dat files
+int fusion_start(ROTATE_POLICY *rotation);
+
+// Write all pending seconds and close the file
+int fusion_stop(void);
+
+// Add a slow loop record. values holds FUSION_CHANNELS values or is
+// NULL for a glitch. Ignored if fusion is not started.
+void fusion_add_radar(double t, double *values);
+
+// Add a distrometer telegram. Ignored if fusion is not started.
+void fusion_add_telegram(double t, char *telegram, int len);
+
+#endif /* FUSION_H */
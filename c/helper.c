@@ -118,10 +118,14 @@ int std_dev(DATA_STRUCT *data, int skip)
 		std_dev_v_i_35 += pow(data->v_i_35->values[i] - data->v_i_35->mean, 2);
 		std_dev_v_q_35 += pow(data->v_q_35->values[i] - data->v_q_35->mean, 2);
 		
-		std_dev_h_a_22 += pow(data->h_a_22->values[i] - data->h_a_22->mean, 2);
-		std_dev_h_a_35 += pow(data->h_a_35->values[i] - data->h_a_35->mean, 2);
-		std_dev_v_a_22 += pow(data->v_a_22->values[i] - data->v_a_22->mean, 2);
-		std_dev_v_a_35 += pow(data->v_a_35->values[i] - data->v_a_35->mean, 2);
+		std_dev_h_a_22 += pow(amp(data->h_i_22->values[i], data->h_q_22->values[i])
+				    - data->h_a_22->mean, 2);
+		std_dev_h_a_35 += pow(amp(data->h_i_35->values[i], data->h_q_35->values[i])
+				    - data->h_a_35->mean, 2);
+		std_dev_v_a_22 += pow(amp(data->v_i_22->values[i], data->v_q_22->values[i])
+				    - data->v_a_22->mean, 2);
+		std_dev_v_a_35 += pow(amp(data->v_i_35->values[i], data->v_q_35->values[i])
+				    - data->v_a_35->mean, 2);
 
 		// STD_DEV of the phase angle?? (How to do this mathematically correct????)
 		std_dev_h_p_22 += pow(data->h_i_22->values[i] - data->h_i_22->mean, 2)/2 + pow(data->h_q_22->values[i] - data->h_q_22->mean, 2)/2;;
@@ -167,6 +171,167 @@ double pha(int I, int Q)
 	else return 0;
 }
 
+/* Coherent mean of the complex samples I + jQ from skip on. With drift
+ * a linear phase drift over the dwell is removed first (referred to the
+ * middle of the dwell). The drift is estimated from the correlation of
+ * the means of DRIFT_SEGMENTS consecutive segments, which works at a low
+ * SNR per sample for drifts up to half a turn per segment. Gives
+ * amplitude and phase of the mean and its SNR in dB, the power of the
+ * mean against the noise power left in it. */
+#define DRIFT_SEGMENTS	8
+
+int coherent_mean(DATA_POINTS *I, DATA_POINTS *Q, int N, int skip, int drift,
+		  double *amplitude, double *phase, double *snr)
+{
+	double n = (double)N - skip;
+	double mid = (skip + N - 1)/2.0;
+	double re = 0, im = 0, power = 0, noise;
+	double seg_re[DRIFT_SEGMENTS], seg_im[DRIFT_SEGMENTS];
+	double r1_re = 0, r1_im = 0, w = 0;
+	double p_re, p_im, step_re, step_im, x, y;
+	int i, k, len = (N - skip)/DRIFT_SEGMENTS;
+
+	if (n < 2)
+		return ERR;
+
+	if (drift && len > 0){
+		for (k = 0; k < DRIFT_SEGMENTS; k++){
+			seg_re[k] = seg_im[k] = 0;
+			for (i = skip + k*len; i < skip + (k+1)*len; i++){
+				seg_re[k] += I->values[i];
+				seg_im[k] += Q->values[i];
+			}
+		}
+		// sum of m[k+1] * conj(m[k]), its phase turns len samples
+		for (k = 0; k < DRIFT_SEGMENTS - 1; k++){
+			r1_re += seg_re[k+1]*seg_re[k] + seg_im[k+1]*seg_im[k];
+			r1_im += seg_im[k+1]*seg_re[k] - seg_re[k+1]*seg_im[k];
+		}
+		w = atan2(r1_im, r1_re)/len;
+	}
+
+	// rotate sample i by -w*(i - mid), the phasor is turned on step by step
+	p_re = cos(-w*(skip - mid));
+	p_im = sin(-w*(skip - mid));
+	step_re = cos(-w);
+	step_im = sin(-w);
+	for (i = skip; i < N; i++){
+		re += I->values[i]*p_re - Q->values[i]*p_im;
+		im += I->values[i]*p_im + Q->values[i]*p_re;
+		power += (double)I->values[i]*I->values[i]
+			 + (double)Q->values[i]*Q->values[i];
+		x = p_re*step_re - p_im*step_im;
+		y = p_re*step_im + p_im*step_re;
+		p_re = x;
+		p_im = y;
+	}
+	re /= n;
+	im /= n;
+
+	// the rotation does not change |z|, the variance of the samples
+	// around the mean divided by n is the noise left in the mean
+	noise = (power - n*(re*re + im*im))/(n - 1)/n;
+	*amplitude = sqrt(re*re + im*im);
+	*phase = atan2(im, re) * 180 / PI;
+	if (*phase < 0)
+		*phase += 360;
+	if (noise <= 0)
+		*snr = 99.9;
+	else if (re*re + im*im <= 0)
+		*snr = -99.9;
+	else
+		*snr = 10*log10((re*re + im*im)/noise);
+	return OK;
+}
+
+// Allocate memory for data struct and return its pointer
+DATA_STRUCT *create_data_struct(int N)
+{
+	DATA_STRUCT *data = malloc(sizeof *data);
+	//data = (DATA_STRUCT*) malloc(sizeof (DATA_STRUCT)); // above one is better
+	//DATA_POINTS *p = malloc(sizeof *p);
+	//data->h_i_22 = p;
+	data->h_i_22 = malloc(sizeof *(data->h_i_22));
+	data->h_q_22 = malloc(sizeof *(data->h_q_22));
+	data->h_i_35 = malloc(sizeof *(data->h_i_35));
+	data->h_q_35 = malloc(sizeof *(data->h_q_35));
+	data->v_i_22 = malloc(sizeof *(data->v_i_22));
+	data->v_q_22 = malloc(sizeof *(data->v_q_22));
+	data->v_i_35 = malloc(sizeof *(data->v_i_35));
+	data->v_q_35 = malloc(sizeof *(data->v_q_35));
+
+	data->h_a_22 = malloc(sizeof *(data->h_a_22));
+	data->h_p_22 = malloc(sizeof *(data->h_p_22));
+	data->h_a_35 = malloc(sizeof *(data->h_a_35));
+	data->h_p_35 = malloc(sizeof *(data->h_p_35));
+	data->v_a_22 = malloc(sizeof *(data->v_a_22));
+	data->v_p_22 = malloc(sizeof *(data->v_p_22));
+	data->v_a_35 = malloc(sizeof *(data->v_a_35));
+	data->v_p_35 = malloc(sizeof *(data->v_p_35));
+	
+	data->h_i_22->values = malloc(sizeof *(data->h_i_22->values) * N);
+	data->h_q_22->values = malloc(sizeof *(data->h_q_22->values) * N);
+	data->h_i_35->values = malloc(sizeof *(data->h_i_35->values) * N);
+	data->h_q_35->values = malloc(sizeof *(data->h_q_35->values) * N);
+	data->v_i_22->values = malloc(sizeof *(data->v_i_22->values) * N);
+	data->v_q_22->values = malloc(sizeof *(data->v_q_22->values) * N);
+	data->v_i_35->values = malloc(sizeof *(data->v_i_35->values) * N);
+	data->v_q_35->values = malloc(sizeof *(data->v_q_35->values) * N);
+	
+	data->h_a_22->values = malloc(sizeof *(data->h_a_22->values) * N);
+	data->h_p_22->values = malloc(sizeof *(data->h_p_22->values) * N);
+	data->h_a_35->values = malloc(sizeof *(data->h_a_35->values) * N);
+	data->h_p_35->values = malloc(sizeof *(data->h_p_35->values) * N);
+	data->v_a_22->values = malloc(sizeof *(data->v_a_22->values) * N);
+	data->v_p_22->values = malloc(sizeof *(data->v_p_22->values) * N);
+	data->v_a_35->values = malloc(sizeof *(data->v_a_35->values) * N);
+	data->v_p_35->values = malloc(sizeof *(data->v_p_35->values) * N);
+
+	return data;
+}
+
+// Free alocated memory of data struct
+int free_data_struct(DATA_STRUCT *data)
+{
+	free(data->h_i_22->values);
+	free(data->h_q_22->values);
+	free(data->h_i_35->values);
+	free(data->h_q_35->values);
+	free(data->v_i_22->values);
+	free(data->v_q_22->values);
+	free(data->v_i_35->values);
+	free(data->v_q_35->values);
+	free(data->h_i_22);
+	free(data->h_q_22);
+	free(data->h_i_35);
+	free(data->h_q_35);
+	free(data->v_i_22);
+	free(data->v_q_22);
+	free(data->v_i_35);
+	free(data->v_q_35);
+	
+	free(data->h_a_22->values);
+	free(data->h_p_22->values);
+	free(data->h_a_35->values);
+	free(data->h_p_35->values);
+	free(data->v_a_22->values);
+	free(data->v_p_22->values);
+	free(data->v_a_35->values);
+	free(data->v_p_35->values);
+	free(data->h_a_22);
+	free(data->h_p_22);
+	free(data->h_a_35);
+	free(data->h_p_35);
+	free(data->v_a_22);
+	free(data->v_p_22);
+	free(data->v_a_35);
+	free(data->v_p_35);
+	
+	free(data);
+	
+	return OK;
+}
+
 /* function to create and check lock files */
 int get_lock_file(char* filename)
 {
@@ -11,6 +11,11 @@ int std_dev(DATA_STRUCT *data, int skip);
 double amp(int I, int q);
 double pha(int I, int q);
 
+// Amplitude, phase and SNR (dB) of the coherent mean of I + jQ, with
+// the phase drift over the dwell removed if drift is set
+int coherent_mean(DATA_POINTS *I, DATA_POINTS *Q, int N, int skip, int drift,
+		  double *amplitude, double *phase, double *snr);
+
 int get_lock_file(char* filename);
 
 
@@ -0,0 +1,194 @@
+/*
+ * jobs.c - Queue for long running commands
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <pthread.h>
+
+#include "usb_control.h"
+#include "jobs.h"
+
+static JOB jobs[JOB_MAX];
+static int next_id = 1;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+
+static char *state_name[] = {"QUEUED", "RUNNING", "DONE", "FAILED", "CANCELLED"};
+
+static JOB *find_job(int id)
+{
+	int i;
+
+	for (i = 0; i < JOB_MAX; i++)
+		if (jobs[i].id == id && id != 0)
+			return &jobs[i];
+	return NULL;
+}
+
+/* Job with the smallest id greater than id */
+static JOB *job_after(int id)
+{
+	JOB *next = NULL;
+	int i;
+
+	for (i = 0; i < JOB_MAX; i++)
+		if (jobs[i].id > id && (next == NULL || jobs[i].id < next->id))
+			next = &jobs[i];
+	return next;
+}
+
+/* Oldest queued job, NULL if there is none */
+static JOB *next_job(void)
+{
+	JOB *next = NULL;
+	int i;
+
+	for (i = 0; i < JOB_MAX; i++)
+		if (jobs[i].id != 0 && jobs[i].state == JOB_QUEUED
+		    && (next == NULL || jobs[i].id < next->id))
+			next = &jobs[i];
+	return next;
+}
+
+static void *worker(void *args)
+{
+	JOB *job;
+	int status;
+
+	pthread_mutex_lock(&jobs_lock);
+	while (1){
+		while ((job = next_job()) == NULL)
+			pthread_cond_wait(&jobs_cond, &jobs_lock);
+
+		job->state = JOB_RUNNING;
+		time(&job->t_start);
+		syslog(LOG_NOTICE, "Job %d (%s) started\n", job->id, job->name);
+		pthread_mutex_unlock(&jobs_lock);
+
+		status = job->run(job);
+
+		pthread_mutex_lock(&jobs_lock);
+		job->status = status;
+		time(&job->t_end);
+		if (job->cancel)
+			job->state = JOB_CANCELLED;
+		else
+			job->state = status == OK ? JOB_DONE : JOB_FAILED;
+		syslog(LOG_NOTICE, "Job %d (%s) %s\n", job->id, job->name,
+		       state_name[job->state]);
+	}
+	return NULL;
+}
+
+int jobs_init(void)
+{
+	pthread_t worker_thread;
+
+	if (pthread_create(&worker_thread, NULL, worker, NULL) != 0)
+		return ERR;
+	pthread_detach(worker_thread);
+	return OK;
+}
+
+int jobs_submit(char *name, int (*run)(JOB *job))
+{
+	JOB *job = NULL;
+	int i, id;
+
+	pthread_mutex_lock(&jobs_lock);
+	// free slot or the job that finished first
+	for (i = 0; i < JOB_MAX; i++){
+		if (jobs[i].id == 0){
+			job = &jobs[i];
+			break;
+		}
+		if (jobs[i].state >= JOB_DONE
+		    && (job == NULL || jobs[i].t_end < job->t_end))
+			job = &jobs[i];
+	}
+	if (job == NULL){
+		pthread_mutex_unlock(&jobs_lock);
+		syslog(LOG_NOTICE, "Job queue full\n");
+		return -1;
+	}
+
+	memset(job, 0, sizeof(JOB));
+	job->id = id = next_id++;
+	snprintf(job->name, sizeof(job->name), "%s", name);
+	job->state = JOB_QUEUED;
+	job->run = run;
+	time(&job->t_submit);
+
+	pthread_cond_signal(&jobs_cond);
+	pthread_mutex_unlock(&jobs_lock);
+	return id;
+}
+
+int jobs_cancel(int id)
+{
+	JOB *job;
+	int status = OK;
+
+	pthread_mutex_lock(&jobs_lock);
+	job = find_job(id);
+	if (job == NULL || job->state >= JOB_DONE)
+		status = ARG_ERR;
+	else if (job->state == JOB_QUEUED){
+		job->state = JOB_CANCELLED;
+		time(&job->t_end);
+	}
+	else
+		job->cancel = 1;	// run stops at its next check
+	pthread_mutex_unlock(&jobs_lock);
+	return status;
+}
+
+int jobs_active(int id)
+{
+	JOB *job;
+	int active;
+
+	pthread_mutex_lock(&jobs_lock);
+	job = find_job(id);
+	active = job != NULL && job->state <= JOB_RUNNING;
+	pthread_mutex_unlock(&jobs_lock);
+	return active;
+}
+
+static int describe(JOB *job, char *buf, int size, int with_result)
+{
+	if (with_result && job->result[0] != '\0')
+		return snprintf(buf, size, "%d %s %s %d %s", job->id, job->name,
+				state_name[job->state], job->status, job->result);
+	return snprintf(buf, size, "%d %s %s %d", job->id, job->name,
+			state_name[job->state], job->status);
+}
+
+int jobs_describe(int id, char *buf, int size, int with_result)
+{
+	JOB *job;
+	int len = 0, last = 0;
+
+	buf[0] = '\0';
+	pthread_mutex_lock(&jobs_lock);
+	if (id != 0){
+		job = find_job(id);
+		if (job != NULL)
+			describe(job, buf, size, with_result);
+		pthread_mutex_unlock(&jobs_lock);
+		return job != NULL ? OK : ARG_ERR;
+	}
+
+	// all jobs, one per line, oldest first
+	while ((job = job_after(last)) != NULL && len < size){
+		last = job->id;
+		if (len > 0)
+			len += snprintf(buf + len, size - len, "\n");
+		if (len < size)
+			len += describe(job, buf + len, size - len, with_result);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+	return OK;
+}
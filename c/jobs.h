@@ -0,0 +1,49 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <time.h>
+
+// Long running commands ("start", "radar") are queued as jobs and run
+// one after the other by a worker thread. The control socket answers
+// with the job id right away.
+#define JOB_MAX			16	// jobs kept, finished ones are reused
+#define JOB_NAME_SIZE		32
+#define JOB_RESULT_SIZE		64
+
+// Job states
+#define JOB_QUEUED		0
+#define JOB_RUNNING		1
+#define JOB_DONE		2
+#define JOB_FAILED		3
+#define JOB_CANCELLED		4
+
+typedef struct job{
+	int		id;		// 0 if the slot was never used
+	char		name[JOB_NAME_SIZE];
+	int		state;
+	int		status;		// return code of run
+	volatile int	cancel;		// set by jobs_cancel, polled by run
+	char		result[JOB_RESULT_SIZE];	// e.g. name of the data file
+	time_t		t_submit;
+	time_t		t_start;
+	time_t		t_end;
+	int		(*run)(struct job *job);
+} JOB;
+
+// Start the worker thread
+int jobs_init(void);
+
+// Queue a job. Returns the job id or -1 if the queue is full.
+int jobs_submit(char *name, int (*run)(JOB *job));
+
+// Cancel a queued job or ask a running one to stop
+int jobs_cancel(int id);
+
+// 1 while job id is queued or running
+int jobs_active(int id);
+
+// Describe job id, or all jobs if id is 0, as text:
+// "<id> <name> <state> <status> [<result>]"
+int jobs_describe(int id, char *buf, int size, int with_result);
+
+#endif /* JOBS_H */
@@ -0,0 +1,287 @@
+/*
+ * outbox.c - Priorities and disk quota of the outbox
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <sys/stat.h>
+
+#include <zlib.h>
+
+#include "attrracd.h"
+#include "outbox.h"
+
+typedef struct{
+	char	name[256];
+	time_t	mtime;
+	long	size;			// -1 when the file is gone
+	int	prio;
+} OB_FILE;
+
+// Values in a slow loop record that are averaged by compaction:
+// 8 I/Q means, T_case, T_pcb, accel1, accel2
+#define AGG_VALUES		12
+
+int outbox_priority(const char *name)
+{
+	const char *ext = strrchr(name, '.');
+
+	if ((ext != NULL && strcmp(ext, ".idx") == 0)
+	    || strncmp(name, "clutter_", 8) == 0)
+		return PRIO_HOUSEKEEPING;
+	if (strncmp(name, "loop_", 5) == 0 || strncmp(name, "agg_", 4) == 0
+	    || strncmp(name, "radar_", 6) == 0 || strncmp(name, "distro_", 7) == 0
+	    || strncmp(name, "fusion_", 7) == 0)
+		return PRIO_AGGREGATE;
+	return PRIO_RAW;
+}
+
+static int cmp_age(const void *a, const void *b)
+{
+	const OB_FILE *fa = a;
+	const OB_FILE *fb = b;
+
+	if (fa->mtime != fb->mtime)
+		return fa->mtime < fb->mtime ? -1 : 1;
+	return strcmp(fa->name, fb->name);
+}
+
+/* List the visible files in dir, oldest first. Returns the number of
+ * files, *files has to be freed by the caller. */
+static int list_outbox(char *dir, OB_FILE **files)
+{
+	OB_FILE *all = NULL;
+	int n = 0, size = 0;
+	DIR *d;
+	struct dirent *entry;
+	struct stat st;
+	char path[512];
+
+	if ((d = opendir(dir)) == NULL){
+		syslog(LOG_ERR, "Could not open %s\n", dir);
+		*files = NULL;
+		return 0;
+	}
+	while ((entry = readdir(d)) != NULL){
+		if (entry->d_name[0] == '.')
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (n == size){
+			size = size ? 2*size : 64;
+			all = realloc(all, size*sizeof(OB_FILE));
+		}
+		snprintf(all[n].name, sizeof(all[n].name), "%s", entry->d_name);
+		all[n].mtime = st.st_mtime;
+		all[n].size = st.st_size;
+		all[n].prio = outbox_priority(entry->d_name);
+		n++;
+	}
+	closedir(d);
+
+	qsort(all, n, sizeof(OB_FILE), cmp_age);
+	*files = all;
+	return n;
+}
+
+/* Slow loop file that can be compacted: loop_YYYYmmdd_HHMM[SS].dat.gz */
+static int is_compactable(char *name)
+{
+	int len = strlen(name);
+
+	return strncmp(name, "loop_", 5) == 0 && isdigit(name[5])
+	       && len > 7 && strcmp(name + len - 7, ".dat.gz") == 0;
+}
+
+/* Write one aggregated record */
+static void write_agg(gzFile out, double t, int n, int glitches,
+		      double *sum, int resets)
+{
+	int valid = n - glitches;
+	int i;
+
+	gzprintf(out, "%.0f; % 5d; % 5d", t, n, glitches);
+	for (i = 0; i < AGG_VALUES; i++){
+		if (i < 8 && valid == 0)
+			gzprintf(out, ";    9999");
+		else if (i < 8)
+			gzprintf(out, "; % 7.1f", sum[i]/valid);
+		else
+			gzprintf(out, "; % 7.1f", sum[i]/n);
+	}
+	gzprintf(out, "; % 7d\n", resets);
+}
+
+int compact_loop_file(char *dir, char *name)
+{
+	char src[512], dst[512], tmp[512];
+	char line[512];
+	gzFile in, out;
+	double v[AGG_VALUES + 1], sum[AGG_VALUES];
+	double t, t_agg = -1;
+	int n = 0, glitches = 0, resets = 0, r, i;
+
+	snprintf(src, sizeof(src), "%s/%s", dir, name);
+	snprintf(dst, sizeof(dst), "%s/agg_%s", dir, name + 5);
+	snprintf(tmp, sizeof(tmp), "%s/.agg_%s.tmp", dir, name + 5);
+
+	if ((in = gzopen(src, "rb")) == NULL)
+		return -1;
+	if ((out = gzopen(tmp, "wb")) == NULL){
+		gzclose(in);
+		return -1;
+	}
+
+	gzprintf(out, "# FILE_TYPE  = SLOW_LOOP_AGG_v1 \n");
+	gzprintf(out, "# source     = %s \n", name);
+	gzprintf(out, "# interval   = %d \n", AGG_INTERVAL);
+	gzprintf(out, "#\n");
+	gzprintf(out, "time;           n; glitch;  I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
+		      "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
+		      "T_case;   T_pcb;  accel1;  accel2;  resets\n");
+
+	while (gzgets(in, line, sizeof(line)) != NULL){
+		// header of source file and checkpoint markers
+		if (line[0] == '#' || !isdigit(line[0]))
+			continue;
+		if (sscanf(line, "%lf; %lf; %lf; %lf; %lf; %lf; %lf; %lf; %lf; "
+			   "%lf; %lf; %lf; %lf; %d", &t, &v[0], &v[1], &v[2],
+			   &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9],
+			   &v[10], &v[11], &r) != 14)
+			continue;
+
+		// new interval
+		if (floor(t/AGG_INTERVAL)*AGG_INTERVAL != t_agg){
+			if (n > 0)
+				write_agg(out, t_agg, n, glitches, sum, resets);
+			t_agg = floor(t/AGG_INTERVAL)*AGG_INTERVAL;
+			n = 0;
+			glitches = 0;
+			for (i = 0; i < AGG_VALUES; i++)
+				sum[i] = 0;
+		}
+
+		n++;
+		resets = r;
+		if (v[0] == 9999){
+			glitches++;
+			for (i = 8; i < AGG_VALUES; i++)
+				sum[i] += v[i];
+		}
+		else{
+			for (i = 0; i < AGG_VALUES; i++)
+				sum[i] += v[i];
+		}
+	}
+	if (n > 0)
+		write_agg(out, t_agg, n, glitches, sum, resets);
+
+	gzclose(in);
+	if (gzclose(out) != Z_OK){
+		syslog(LOG_ERR, "Could not compact %s\n", name);
+		unlink(tmp);
+		return -1;
+	}
+	// the source goes only once its aggregate is there. The uploader
+	// may have claimed it meanwhile, then it is sent as well.
+	if (rename(tmp, dst) != 0){
+		syslog(LOG_ERR, "Could not compact %s\n", name);
+		unlink(tmp);
+		return -1;
+	}
+	unlink(src);
+	return 0;
+}
+
+long outbox_enforce_quota(char *dir, long quota)
+{
+	OB_FILE *files;
+	int n, i, prio;
+	long total = 0;
+	time_t now = time(NULL);
+	char path[512];
+	struct stat st;
+
+	n = list_outbox(dir, &files);
+	for (i = 0; i < n; i++)
+		total += files[i].size;
+
+	if (total > quota)
+		syslog(LOG_NOTICE, "Outbox over quota (%ld > %ld bytes)\n",
+		       total, quota);
+
+	// compact old slow loop files, oldest first
+	for (i = 0; i < n && total > quota; i++){
+		if (!is_compactable(files[i].name)
+		    || now - files[i].mtime < OUTBOX_COMPACT_AGE)
+			continue;
+		if (compact_loop_file(dir, files[i].name) != 0)
+			continue;
+		total -= files[i].size;
+		files[i].size = -1;
+		snprintf(path, sizeof(path), "%s/agg_%s", dir, files[i].name + 5);
+		if (stat(path, &st) == 0)
+			total += st.st_size;
+	}
+
+	// nothing left to compact: drop files, raw bursts first
+	for (prio = PRIO_RAW; prio >= PRIO_HOUSEKEEPING && total > quota; prio--){
+		for (i = 0; i < n && total > quota; i++){
+			if (files[i].size < 0 || files[i].prio != prio)
+				continue;
+			// fails if the uploader claimed the file meanwhile
+			snprintf(path, sizeof(path), "%s/%s", dir, files[i].name);
+			if (unlink(path) != 0)
+				continue;
+			syslog(LOG_WARNING, "Outbox over quota, deleted %s\n",
+			       files[i].name);
+			total -= files[i].size;
+			files[i].size = -1;
+		}
+	}
+
+	free(files);
+	return total;
+}
+
+/* Remove the aggregates of a compaction that was interrupted */
+static void remove_stale_tmp(char *dir)
+{
+	DIR *d;
+	struct dirent *entry;
+	char path[512];
+	int len;
+
+	if ((d = opendir(dir)) == NULL)
+		return;
+	while ((entry = readdir(d)) != NULL){
+		len = strlen(entry->d_name);
+		if (strncmp(entry->d_name, ".agg_", 5) != 0 || len < 4
+		    || strcmp(entry->d_name + len - 4, ".tmp") != 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+		if (unlink(path) == 0)
+			syslog(LOG_NOTICE, "Removed stale %s\n", entry->d_name);
+	}
+	closedir(d);
+}
+
+void *outbox_loop(void *args)
+{
+	struct outbox_args *a = (struct outbox_args *) args;
+
+	remove_stale_tmp(a->dir);
+	while (1){
+		outbox_enforce_quota(a->dir, __atomic_load_n(a->quota, __ATOMIC_RELAXED));
+		sleep(OUTBOX_CHECK_INTERVAL);
+	}
+	return NULL;
+}
@@ -0,0 +1,47 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+/* Files waiting in OUTBOX_DIR are sent in the order of their priority
+ * class, oldest first within a class. Small summaries go first, so that
+ * the server has an overview even when the link is slow. */
+#define PRIO_HOUSEKEEPING	0	// zone maps (*.idx), clutter map
+					// snapshots (clutter_*)
+#define PRIO_AGGREGATE		1	// slow loop (loop_*), compacted (agg_*),
+					// radar profiles (radar_*),
+					// distrometer (distro_*), fusion (fusion_*)
+#define PRIO_RAW		2	// burst I/Q dumps (iq_*) and the rest
+
+/* Disk quota of the outbox. When it is exceeded, slow loop files older
+ * than OUTBOX_COMPACT_AGE are compacted to averages over AGG_INTERVAL
+ * seconds. Raw bursts are only deleted if nothing is left to compact. */
+#define OUTBOX_QUOTA		(256L*1024*1024)
+#define OUTBOX_CHECK_INTERVAL	60	// s between quota checks
+#define OUTBOX_COMPACT_AGE	3600	// s
+#define AGG_INTERVAL		60	// s
+
+// The uploader renames a file to OUTBOX_CLAIM_PREFIX<name> while it
+// sends it. Claimed files are hidden, the quota leaves them alone.
+#define OUTBOX_CLAIM_PREFIX	".sending."
+
+// Priority class of a file in the outbox
+int outbox_priority(const char *name);
+
+// Compact slow loop file dir/name (loop_*.dat.gz) to dir/agg_*.dat.gz
+// and delete it. Returns 0 on success, -1 on error.
+int compact_loop_file(char *dir, char *name);
+
+// Bring the outbox below quota bytes. Returns the bytes in use after.
+long outbox_enforce_quota(char *dir, long quota);
+
+// Arguments of outbox_loop
+struct outbox_args{
+	char	*dir;
+	long	*quota;		// bytes, changed atomically while the thread runs
+};
+
+// Thread checking the quota every OUTBOX_CHECK_INTERVAL. args points to
+// a struct outbox_args. At its start it removes what an interrupted
+// compaction left behind.
+void *outbox_loop(void *args);
+
+#endif /* OUTBOX_H */
@@ -0,0 +1,174 @@
+/*
+ * pubsub.c - Live feed of slow loop records for control clients
+ *
+ * The slow loop publishes from its own thread. Messages are copied into
+ * the queue of every subscriber and the eventfd wakes the server, which
+ * moves them to the sockets as far as the clients read them.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "usb_control.h"
+#include "pubsub.h"
+
+typedef struct{
+	int	id;			// client id, -1 if the slot is free
+	int	every[PUBSUB_TOPICS];	// 0 if not subscribed
+	int	count[PUBSUB_TOPICS];
+	int	head;			// oldest message
+	int	n;
+	long	dropped;		// since the last delivered message
+	int	len[PUBSUB_QUEUE_LEN];
+	char	msg[PUBSUB_QUEUE_LEN][PUBSUB_MSG_SIZE];
+} SUBSCRIBER;
+
+static char *topic_name[] = {"stats", "iq"};
+
+static SUBSCRIBER subs[PUBSUB_MAX_SUBSCRIBERS];
+static volatile int n_subscribed[PUBSUB_TOPICS];
+static pthread_mutex_t pubsub_lock = PTHREAD_MUTEX_INITIALIZER;
+static int event_fd = -1;
+
+static SUBSCRIBER *find_subscriber(int id)
+{
+	int i;
+
+	for (i = 0; i < PUBSUB_MAX_SUBSCRIBERS; i++)
+		if (subs[i].id == id)
+			return &subs[i];
+	return NULL;
+}
+
+int pubsub_init(void)
+{
+	int i;
+
+	for (i = 0; i < PUBSUB_MAX_SUBSCRIBERS; i++)
+		subs[i].id = -1;
+	event_fd = eventfd(0, EFD_NONBLOCK);
+	return event_fd < 0 ? -1 : 0;
+}
+
+int pubsub_fd(void)
+{
+	return event_fd;
+}
+
+int pubsub_subscribe(int id, char *topic, int every)
+{
+	SUBSCRIBER *s;
+	int t;
+
+	for (t = 0; t < PUBSUB_TOPICS; t++)
+		if (strcmp(topic, topic_name[t]) == 0)
+			break;
+	if (t == PUBSUB_TOPICS || every < 1 || id < 0)
+		return ARG_ERR;
+
+	pthread_mutex_lock(&pubsub_lock);
+	if ((s = find_subscriber(id)) == NULL
+	    && (s = find_subscriber(-1)) != NULL){
+		memset(s, 0, sizeof(SUBSCRIBER));
+		s->id = id;
+	}
+	if (s == NULL){
+		pthread_mutex_unlock(&pubsub_lock);
+		syslog(LOG_NOTICE, "Too many subscribers\n");
+		return ERR;
+	}
+	if (s->every[t] == 0)
+		n_subscribed[t]++;
+	s->every[t] = every;
+	s->count[t] = 0;
+	pthread_mutex_unlock(&pubsub_lock);
+
+	syslog(LOG_INFO, "Client subscribed to %s, every %d\n", topic, every);
+	return OK;
+}
+
+void pubsub_unsubscribe(int id)
+{
+	SUBSCRIBER *s;
+	int t;
+
+	pthread_mutex_lock(&pubsub_lock);
+	if ((s = find_subscriber(id)) != NULL){
+		for (t = 0; t < PUBSUB_TOPICS; t++)
+			if (s->every[t] != 0)
+				n_subscribed[t]--;
+		s->id = -1;
+	}
+	pthread_mutex_unlock(&pubsub_lock);
+}
+
+int pubsub_active(int topic)
+{
+	return n_subscribed[topic] > 0;
+}
+
+void pubsub_publish(int topic, char *msg, int len)
+{
+	uint64_t one = 1;
+	SUBSCRIBER *s;
+	int i, slot, queued = 0;
+
+	if (len > PUBSUB_MSG_SIZE)
+		len = PUBSUB_MSG_SIZE;
+
+	pthread_mutex_lock(&pubsub_lock);
+	for (i = 0; i < PUBSUB_MAX_SUBSCRIBERS; i++){
+		s = &subs[i];
+		if (s->id < 0 || s->every[topic] == 0)
+			continue;
+		if (s->count[topic]++ % s->every[topic] != 0)
+			continue;
+
+		// drop the oldest message if the queue is full
+		if (s->n == PUBSUB_QUEUE_LEN){
+			s->head = (s->head + 1) % PUBSUB_QUEUE_LEN;
+			s->n--;
+			s->dropped++;
+		}
+		slot = (s->head + s->n) % PUBSUB_QUEUE_LEN;
+		memcpy(s->msg[slot], msg, len);
+		s->len[slot] = len;
+		s->n++;
+		queued = 1;
+	}
+	pthread_mutex_unlock(&pubsub_lock);
+
+	// fails only if the counter overflows, the server is woken up anyway
+	if (queued && write(event_fd, &one, sizeof(one)) < 0)
+		syslog(LOG_DEBUG, "pubsub: eventfd write failed\n");
+}
+
+int pubsub_fetch(int id, char *buf, int size)
+{
+	SUBSCRIBER *s;
+	int len = 0;
+
+	pthread_mutex_lock(&pubsub_lock);
+	s = find_subscriber(id);
+	if (s != NULL && s->dropped > 0){
+		// tell the client about the gap before the next message
+		len = snprintf(buf, size, "PUB dropped %ld", s->dropped);
+		if (len < size)
+			s->dropped = 0;
+		else
+			len = 0;
+	}
+	else if (s != NULL && s->n > 0 && s->len[s->head] <= size){
+		len = s->len[s->head];
+		memcpy(buf, s->msg[s->head], len);
+		s->head = (s->head + 1) % PUBSUB_QUEUE_LEN;
+		s->n--;
+	}
+	pthread_mutex_unlock(&pubsub_lock);
+	return len;
+}
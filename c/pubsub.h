@@ -0,0 +1,38 @@
+#ifndef PUBSUB_H
+#define PUBSUB_H
+
+// Live feed of the slow loop for clients of the control server. Every
+// subscriber has its own bounded queue. When a queue is full the oldest
+// message is dropped, so a slow client never blocks the acquisition.
+#define PUBSUB_MAX_SUBSCRIBERS	8
+#define PUBSUB_QUEUE_LEN	64	// messages per subscriber
+#define PUBSUB_MSG_SIZE		1024	// same as SERVER_MAX_MSG
+#define PUBSUB_IQ_SAMPLES	16	// samples per channel in an iq message
+
+// Topics
+#define PUBSUB_STATS		0	// per burst means, amplitudes, temperatures
+#define PUBSUB_IQ		1	// decimated raw I/Q of a burst
+#define PUBSUB_TOPICS		2
+
+// Create the eventfd that becomes readable when messages are queued
+int pubsub_init(void);
+int pubsub_fd(void);
+
+// Subscribe client id to a topic by name, keeping every n-th message.
+// Returns OK or ARG_ERR.
+int pubsub_subscribe(int id, char *topic, int every);
+
+// Remove client id from all topics
+void pubsub_unsubscribe(int id);
+
+// 1 if anybody subscribed to topic, cheap enough to call for every burst
+int pubsub_active(int topic);
+
+// Queue a message for all subscribers of topic
+void pubsub_publish(int topic, char *msg, int len);
+
+// Take the next message for client id. Returns its length, 0 if the
+// queue is empty.
+int pubsub_fetch(int id, char *buf, int size);
+
+#endif /* PUBSUB_H */
@@ -0,0 +1,216 @@
+/*
+ * receiver.c - Counterpart of uploader.c on the data server. Stores the
+ * files sent by the uploader in a directory.
+ *
+ * Usage: receiver [port] [dir]
+ *
+ * Serves one uploader at a time, which is all the SBC uses. Also useful
+ * to test the uploader against a local directory.
+ *
+ * The protocol has no authentication, so the receiver only listens on
+ * 127.0.0.1. The uploader reaches it through an ssh tunnel opened from
+ * the SBC (see scripts/START.sh), which does the authentication. A
+ * stored file is never replaced by another one of the same name.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <syslog.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "upload.h"
+
+typedef struct{
+	char	name[UP_NAME_MAX];
+	char	part[UP_NAME_MAX + 8];	// ".name.part"
+	long	size;
+	int	fd;			// -1 if nothing to write
+	int	complete;		// file was already stored before
+} RX_SLOT;
+
+static RX_SLOT slots[UP_BATCH_FILES];
+
+static void close_slots(void)
+{
+	int i;
+
+	for (i = 0; i < UP_BATCH_FILES; i++){
+		if (slots[i].fd >= 0)
+			close(slots[i].fd);
+		slots[i].fd = -1;
+	}
+}
+
+/* Prepare a slot for an offered file. Returns the offset the uploader
+ * has to continue from. */
+static long offer(RX_SLOT *s, char *name, long size)
+{
+	struct stat st;
+	long offset;
+
+	strcpy(s->name, name);
+	snprintf(s->part, sizeof(s->part), ".%s.part", name);
+	s->size = size;
+	s->complete = 0;
+	if (s->fd >= 0)
+		close(s->fd);
+	s->fd = -1;
+
+	if (stat(name, &st) == 0){
+		// ACK got lost last time, file is already there
+		if (st.st_size == size){
+			s->complete = 1;
+			return size;
+		}
+		// another file of that name, no data is taken and END is
+		// answered with NAK
+		syslog(LOG_ERR, "%s exists with %ld bytes, refused", name,
+		       (long)st.st_size);
+		return size;
+	}
+
+	s->fd = open(s->part, O_WRONLY | O_CREAT, 0644);
+	if (s->fd < 0){
+		syslog(LOG_ERR, "Could not open %s", s->part);
+		return 0;
+	}
+	offset = lseek(s->fd, 0, SEEK_END);
+	if (offset > size){
+		ftruncate(s->fd, 0);
+		offset = lseek(s->fd, 0, SEEK_SET);
+	}
+	return offset;
+}
+
+/* Finish a file. Returns 0 if it is stored. */
+static int finish(RX_SLOT *s, long size, long *have)
+{
+	*have = s->size;
+	if (s->complete)
+		return 0;
+	if (s->fd < 0)
+		return -1;
+
+	*have = lseek(s->fd, 0, SEEK_END);
+	if (*have != size || fsync(s->fd) != 0)
+		return -1;
+	close(s->fd);
+	s->fd = -1;
+	// link does not replace a file that showed up in the meantime
+	if (link(s->part, s->name) != 0){
+		syslog(LOG_ERR, "Could not store %s", s->name);
+		return -1;
+	}
+	unlink(s->part);
+	syslog(LOG_INFO, "Received %s (%ld bytes)", s->name, size);
+	return 0;
+}
+
+static void handle_connection(int fd, char *buf)
+{
+	UP_HEADER h;
+	RX_SLOT *s;
+	long have;
+	int status = 0;
+
+	while (status == 0 && up_recv(fd, &h) == 0){
+		if (h.id >= UP_BATCH_FILES || h.length > UP_CHUNK_SIZE){
+			syslog(LOG_ERR, "Invalid message from uploader");
+			break;
+		}
+		s = &slots[h.id];
+		if (h.length > 0 && read_all(fd, buf, h.length) != 0)
+			break;
+
+		switch (h.type){
+		case UP_OFFER:
+			buf[h.length < UP_NAME_MAX ? h.length : UP_NAME_MAX - 1] = '\0';
+			if (!up_valid_name(buf)){
+				syslog(LOG_ERR, "Invalid file name from uploader");
+				status = -1;
+				break;
+			}
+			status = up_send(fd, UP_RESUME, h.id,
+					 offer(s, buf, h.value), NULL, 0);
+			break;
+		case UP_DATA:
+			if (s->fd >= 0 && write_all(s->fd, buf, h.length) != 0){
+				syslog(LOG_ERR, "Could not write %s", s->part);
+				close(s->fd);
+				s->fd = -1;
+			}
+			break;
+		case UP_END:
+			if (finish(s, h.value, &have) == 0)
+				status = up_send(fd, UP_ACK, h.id, h.value, NULL, 0);
+			else
+				status = up_send(fd, UP_NAK, h.id, have, NULL, 0);
+			break;
+		default:
+			syslog(LOG_ERR, "Unknown message type %u", h.type);
+			status = -1;
+		}
+	}
+	// partial files are kept, the uploader resumes them
+	close_slots();
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in strAddr;
+	socklen_t lenAddr;
+	int fdSock, fdConn, on = 1, i;
+	int port = UPLOAD_PORT;
+	char *buf;
+
+	if (argc > 1)
+		port = atoi(argv[1]);
+	if (argc > 2 && chdir(argv[2]) != 0){
+		printf("Could not change to %s\n", argv[2]);
+		return 1;
+	}
+
+	openlog("receiver", LOG_PID | LOG_PERROR, LOG_USER);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (i = 0; i < UP_BATCH_FILES; i++)
+		slots[i].fd = -1;
+	buf = malloc(UP_CHUNK_SIZE);
+
+	if ((fdSock = socket(AF_INET, SOCK_STREAM, 0)) < 0){
+		syslog(LOG_ERR, "Could not open socket. Exit.");
+		return 1;
+	}
+	setsockopt(fdSock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	memset(&strAddr, 0, sizeof(strAddr));
+	strAddr.sin_family = AF_INET;
+	strAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	strAddr.sin_port = htons(port);
+	if (bind(fdSock, (struct sockaddr*)&strAddr, sizeof(strAddr)) != 0){
+		syslog(LOG_ERR, "Could not bind socket. Exit");
+		return 1;
+	}
+	if (listen(fdSock, 1) != 0){
+		syslog(LOG_ERR, "Socket could not listen. Exit");
+		return 1;
+	}
+
+	while (1){
+		lenAddr = sizeof(strAddr);
+		fdConn = accept(fdSock, (struct sockaddr*)&strAddr, &lenAddr);
+		if (fdConn < 0)
+			continue;
+		syslog(LOG_INFO, "Uploader connected");
+		handle_connection(fdConn, buf);
+		close(fdConn);
+		syslog(LOG_INFO, "Uploader disconnected");
+	}
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * schedule.c - Jobs started at wall clock times
+ *
+ * One thread sleeps on a timerfd that is set to the earliest due time
+ * of all entries. The time is absolute on CLOCK_REALTIME, so runs stay
+ * on their boundaries however long the jobs take. When the clock is set
+ * (date -s at boot) the timer is cancelled and all entries are computed
+ * again from the new time, missed runs are not caught up.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <sys/timerfd.h>
+
+#include "usb_control.h"
+#include "jobs.h"
+#include "schedule.h"
+
+#ifndef TFD_TIMER_CANCEL_ON_SET
+#define TFD_TIMER_CANCEL_ON_SET	(1 << 1)	// older headers, Linux >= 2.6.38
+#endif
+
+#define SPEC_SIZE	32
+
+typedef struct{
+	char		name[SCHEDULE_NAME_SIZE];	// "" if the slot is free
+	char		spec[SPEC_SIZE];
+	uint64_t	sec, min, hour;	// bit n set if n matches
+	time_t		next;		// next run
+	int		job;		// id of the last submitted job
+	long		runs;
+	long		skipped;	// last job was still busy
+} ENTRY;
+
+static ENTRY entries[SCHEDULE_MAX];
+static pthread_mutex_t schedule_lock = PTHREAD_MUTEX_INITIALIZER;
+static schedule_submit submit_job;
+static int timer_fd = -1;
+
+/* Parse one field of a spec into a mask of the values 0..max-1 */
+static int parse_field(char *field, int max, uint64_t *bits)
+{
+	char buf[SPEC_SIZE], *item, *saveptr, *end;
+	long a, b, step;
+
+	*bits = 0;
+	snprintf(buf, sizeof(buf), "%s", field);
+	for (item = strtok_r(buf, ",", &saveptr); item != NULL;
+	     item = strtok_r(NULL, ",", &saveptr)){
+		if (item[0] == '*'){
+			a = 0;
+			b = max - 1;
+			end = item + 1;
+		}
+		else{
+			a = b = strtol(item, &end, 10);
+			if (end == item)
+				return ARG_ERR;
+			if (*end == '-'){
+				item = end + 1;
+				b = strtol(item, &end, 10);
+				if (end == item)
+					return ARG_ERR;
+			}
+		}
+		step = 1;
+		if (*end == '/'){
+			item = end + 1;
+			step = strtol(item, &end, 10);
+			if (end == item)
+				return ARG_ERR;
+		}
+		if (*end != '\0' || a < 0 || b >= max || a > b || step < 1)
+			return ARG_ERR;
+		for (; a <= b; a += step)
+			*bits |= (uint64_t)1 << a;
+	}
+	return *bits != 0 ? OK : ARG_ERR;
+}
+
+/* First time after t that matches the entry */
+static time_t next_time(ENTRY *e, time_t t)
+{
+	time_t limit = t + 2*86400;
+	struct tm tm;
+
+	for (t = t + 1; t < limit; ){
+		gmtime_r(&t, &tm);
+		if (!(e->hour >> tm.tm_hour & 1))
+			t += 3600 - 60*tm.tm_min - tm.tm_sec;
+		else if (!(e->min >> tm.tm_min & 1))
+			t += 60 - tm.tm_sec;
+		else if (!(e->sec >> tm.tm_sec & 1))
+			t++;
+		else
+			return t;
+	}
+	return limit;		// not reached with a valid spec
+}
+
+/* Set the timer to the earliest entry, disarm it if there is none.
+ * Called with the lock held. */
+static void arm_timer(void)
+{
+	struct itimerspec its;
+	int i;
+
+	memset(&its, 0, sizeof(its));
+	for (i = 0; i < SCHEDULE_MAX; i++)
+		if (entries[i].name[0] != '\0' && (its.it_value.tv_sec == 0
+		    || entries[i].next < its.it_value.tv_sec))
+			its.it_value.tv_sec = entries[i].next;
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET,
+			&its, NULL);
+}
+
+static void *scheduler(void *args)
+{
+	uint64_t expirations;
+	int i, id, clock_set;
+	time_t now;
+	ENTRY *e;
+
+	while (1){
+		clock_set = read(timer_fd, &expirations, sizeof(expirations)) < 0
+			    && errno == ECANCELED;
+		time(&now);
+
+		pthread_mutex_lock(&schedule_lock);
+		for (i = 0; i < SCHEDULE_MAX; i++){
+			e = &entries[i];
+			if (e->name[0] == '\0' || (e->next > now && !clock_set))
+				continue;
+			if (clock_set){
+				e->next = next_time(e, now);
+				continue;
+			}
+			if (jobs_active(e->job)){
+				e->skipped++;
+				syslog(LOG_NOTICE, "Schedule: %s still busy, skipped\n",
+				       e->name);
+			}
+			else if ((id = submit_job(e->name)) > 0){
+				e->job = id;
+				e->runs++;
+			}
+			e->next = next_time(e, now);
+		}
+		if (clock_set)
+			syslog(LOG_NOTICE, "Schedule: clock was set\n");
+		arm_timer();
+		pthread_mutex_unlock(&schedule_lock);
+	}
+	return NULL;
+}
+
+int schedule_init(schedule_submit submit)
+{
+	pthread_t schedule_thread;
+
+	submit_job = submit;
+	timer_fd = timerfd_create(CLOCK_REALTIME, 0);
+	if (timer_fd < 0
+	    || pthread_create(&schedule_thread, NULL, scheduler, NULL) != 0)
+		return ERR;
+	pthread_detach(schedule_thread);
+	return OK;
+}
+
+int schedule_set(char *name, char *spec)
+{
+	char buf[SPEC_SIZE], *field[3], *token, *saveptr;
+	ENTRY e, *slot = NULL;
+	int i, n = 0;
+
+	memset(&e, 0, sizeof(e));
+	snprintf(buf, sizeof(buf), "%s", spec);
+	for (token = strtok_r(buf, " \t", &saveptr); token != NULL;
+	     token = strtok_r(NULL, " \t", &saveptr)){
+		if (n == 3)
+			return ARG_ERR;
+		field[n++] = token;
+	}
+	if (n == 0 || strlen(name) >= SCHEDULE_NAME_SIZE)
+		return ARG_ERR;
+
+	if (!(n == 1 && strcmp(field[0], "off") == 0)){
+		if (n != 3
+		    || parse_field(field[0], 60, &e.sec) != OK
+		    || parse_field(field[1], 60, &e.min) != OK
+		    || parse_field(field[2], 24, &e.hour) != OK){
+			syslog(LOG_NOTICE, "Schedule: bad time %s\n", spec);
+			return ARG_ERR;
+		}
+		snprintf(e.name, sizeof(e.name), "%s", name);
+		snprintf(e.spec, sizeof(e.spec), "%s %s %s", field[0], field[1], field[2]);
+		e.next = next_time(&e, time(NULL));
+	}
+
+	pthread_mutex_lock(&schedule_lock);
+	for (i = 0; i < SCHEDULE_MAX && slot == NULL; i++)
+		if (strcmp(entries[i].name, name) == 0)
+			slot = &entries[i];
+	for (i = 0; i < SCHEDULE_MAX && slot == NULL && e.name[0] != '\0'; i++)
+		if (entries[i].name[0] == '\0')
+			slot = &entries[i];
+	if (slot == NULL){
+		pthread_mutex_unlock(&schedule_lock);
+		return ARG_ERR;
+	}
+	// a busy job of the old entry still blocks the new one
+	e.job = slot->job;
+	*slot = e;
+	arm_timer();
+	pthread_mutex_unlock(&schedule_lock);
+
+	syslog(LOG_NOTICE, "Schedule: %s %s\n", name, e.name[0] ? e.spec : "off");
+	return OK;
+}
+
+int schedule_describe(char *buf, int size)
+{
+	char next[16];
+	struct tm tm;
+	int i, len = 0;
+
+	buf[0] = '\0';
+	pthread_mutex_lock(&schedule_lock);
+	for (i = 0; i < SCHEDULE_MAX && len < size; i++){
+		if (entries[i].name[0] == '\0')
+			continue;
+		gmtime_r(&entries[i].next, &tm);
+		strftime(next, sizeof(next), "%H:%M:%S", &tm);
+		len += snprintf(buf + len, size - len, "%s%s %s next=%s runs=%ld skipped=%ld",
+				len > 0 ? "\n" : "", entries[i].name, entries[i].spec,
+				next, entries[i].runs, entries[i].skipped);
+	}
+	pthread_mutex_unlock(&schedule_lock);
+	return OK;
+}
@@ -0,0 +1,29 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+// Measurements started by the daemon at wall clock times, e.g. a burst
+// at every full minute and a radar sweep every 10 s. An entry is a job
+// ("start", "radar") and a cron like time "<sec> <min> <hour>" in UTC.
+// Every field is "*", a value, a range "a-b", each with an optional
+// step "/n", or a list of these separated by ",":
+//	"0 * *"		every full minute
+//	"*/10 * *"	every 10 s, at :00, :10, ...
+//	"30 0,30 *"	twice per hour
+// A job is not submitted again while its last run is queued or running.
+#define SCHEDULE_MAX		8
+#define SCHEDULE_NAME_SIZE	32
+
+// Submits the job name, returns its id or -1
+typedef int (*schedule_submit)(char *name);
+
+// Start the scheduler thread
+int schedule_init(schedule_submit submit);
+
+// Schedule job name at spec, replacing its old entry. spec "off"
+// removes it. Returns OK or ARG_ERR.
+int schedule_set(char *name, char *spec);
+
+// One line per entry: "<name> <spec> next=<time> runs=<n> skipped=<n>"
+int schedule_describe(char *buf, int size);
+
+#endif /* SCHEDULE_H */
@@ -0,0 +1,565 @@
+/*
+ * server.c - epoll based control server for attrracd
+ */
+
+#define _GNU_SOURCE		/* for struct ucred */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+
+#include "usb_control.h"
+#include "server.h"
+#include "pubsub.h"
+
+#define MAX_LISTEN		4
+#define MAX_EVENTS		16
+
+typedef struct{
+	int	fd;			// -1 if the slot is free
+	unsigned char in[4 + SERVER_MAX_MSG];
+	int	in_len;
+	char	out[SERVER_OUT_BUF];
+	int	out_len;
+	time_t	last_active;		// time of last request
+	time_t	msg_start;		// time the pending request started
+	int	subscribed;		// gets messages of the live feed
+	int	packet;			// SOCK_SEQPACKET, one message per packet
+	int	later;			// a request waits for its reply in pending
+	SERVER_PENDING pending;
+} CLIENT;
+
+static CLIENT clients[SERVER_MAX_CLIENTS];
+static int listen_fds[MAX_LISTEN];
+static int listen_types[MAX_LISTEN];	// SOCK_STREAM or SOCK_SEQPACKET
+static int n_listen = 0;
+static int epfd = -1;
+static int sigfd = -1;
+static int done_fd = -1;		// eventfd of server_done
+
+static int set_nonblock(int fd)
+{
+	int flags = fcntl(fd, F_GETFL, 0);
+
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+static CLIENT *find_client(int fd)
+{
+	int i;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+		if (clients[i].fd == fd)
+			return &clients[i];
+	return NULL;
+}
+
+/* A slot is only free once the reply of a closed client is done, the
+ * answering thread still writes to its pending */
+static CLIENT *free_client(void)
+{
+	int i;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+		if (clients[i].fd < 0 && !clients[i].later)
+			return &clients[i];
+	return NULL;
+}
+
+static void close_client(CLIENT *c)
+{
+	if (c->subscribed)
+		pubsub_unsubscribe(c->fd);
+	c->subscribed = 0;
+	epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	c->fd = -1;
+}
+
+/* Requests are not read while one waits for its reply */
+static void watch(CLIENT *c, int out)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (c->later ? 0 : EPOLLIN) | (out ? EPOLLOUT : 0);
+	ev.data.fd = c->fd;
+	epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+/* Packet clients get every message as a packet of its own, without the
+ * length in front */
+static int flush_packets(CLIENT *c)
+{
+	uint32_t len;
+	ssize_t n;
+
+	while (c->out_len > 0){
+		memcpy(&len, c->out, 4);
+		len = ntohl(len);
+		n = send(c->fd, c->out + 4, len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n != len)
+			return -1;
+		c->out_len -= 4 + len;
+		memmove(c->out, c->out + 4 + len, c->out_len);
+	}
+	watch(c, c->out_len > 0);
+	return 0;
+}
+
+/* Write as much of the pending replies as the socket takes */
+static int flush_client(CLIENT *c)
+{
+	ssize_t n;
+
+	if (c->packet)
+		return flush_packets(c);
+
+	while (c->out_len > 0){
+		n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (n <= 0)
+			return -1;
+		c->out_len -= n;
+		memmove(c->out, c->out + n, c->out_len);
+	}
+	watch(c, c->out_len > 0);
+	return 0;
+}
+
+/* Queue a reply. A client that does not read its replies is dropped. */
+static int queue_reply(CLIENT *c, char *reply, int len)
+{
+	uint32_t l = htonl(len);
+
+	if (c->out_len + 4 + len > SERVER_OUT_BUF){
+		syslog(LOG_NOTICE, "Client does not read replies, closing\n");
+		return -1;
+	}
+	memcpy(c->out + c->out_len, &l, 4);
+	memcpy(c->out + c->out_len + 4, reply, len);
+	c->out_len += 4 + len;
+	return flush_client(c);
+}
+
+/* Move queued feed messages to the client. Room for one reply is kept
+ * free, messages that do not fit wait in the feed queue. */
+static int deliver(CLIENT *c)
+{
+	uint32_t l;
+	int len, room, full;
+
+	do{
+		full = 0;
+		while (1){
+			room = SERVER_OUT_BUF - c->out_len - 4 - (4 + SERVER_MAX_MSG);
+			if (room <= 0){
+				full = 1;
+				break;
+			}
+			len = pubsub_fetch(c->fd, c->out + c->out_len + 4, room);
+			if (len == 0)
+				break;
+			l = htonl(len);
+			memcpy(c->out + c->out_len, &l, 4);
+			c->out_len += 4 + len;
+		}
+		if (flush_client(c) != 0)
+			return -1;
+	// the socket took everything, there may be more in the queue
+	} while (full && c->out_len == 0);
+	return 0;
+}
+
+/* "subscribe <topic> [every]" and "unsubscribe" belong to the connection
+ * and are answered here. Returns the reply length, 0 for other requests. */
+static int handle_feed(CLIENT *c, char *request, char *reply, int size)
+{
+	char cmd[32], topic[32];
+	int every = 1, n, status;
+
+	n = sscanf(request, "%31s %31s %d", cmd, topic, &every);
+	if (n >= 1 && strcmp(cmd, "unsubscribe") == 0){
+		pubsub_unsubscribe(c->fd);
+		c->subscribed = 0;
+		return snprintf(reply, size, "OK");
+	}
+	if (n < 1 || strcmp(cmd, "subscribe") != 0)
+		return 0;
+
+	status = n >= 2 ? pubsub_subscribe(c->fd, topic, every) : ARG_ERR;
+	if (status != OK)
+		return snprintf(reply, size, "ERR %d", status);
+	c->subscribed = 1;
+	return snprintf(reply, size, "OK");
+}
+
+/* Answer a request, or start it if the handler answers it later */
+static int answer(CLIENT *c, char *request, server_handler handler)
+{
+	char reply[SERVER_MAX_MSG];
+	int reply_len;
+
+	time(&c->last_active);
+	reply_len = handle_feed(c, request, reply, sizeof(reply));
+	if (reply_len == 0){
+		c->pending.done = 0;
+		reply_len = handler(request, reply, sizeof(reply), &c->pending);
+	}
+	if (reply_len == SERVER_LATER){
+		c->later = 1;
+		watch(c, c->out_len > 0);
+		return 0;
+	}
+	return queue_reply(c, reply, reply_len);
+}
+
+/* Every packet is one request */
+static int read_packets(CLIENT *c, server_handler handler)
+{
+	char request[SERVER_MAX_MSG + 1];
+	ssize_t n;
+
+	while (!c->later){
+		n = recv(c->fd, request, sizeof(request), MSG_TRUNC);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+		if (n > SERVER_MAX_MSG){
+			syslog(LOG_NOTICE, "Request too long, closing client\n");
+			return -1;
+		}
+
+		request[n] = '\0';
+		if (answer(c, request, handler) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Handle the complete requests in the input buffer, up to one that is
+ * answered later */
+static int handle_input(CLIENT *c, server_handler handler)
+{
+	char request[SERVER_MAX_MSG + 1];
+	uint32_t len;
+
+	while (!c->later && c->in_len >= 4){
+		memcpy(&len, c->in, 4);
+		len = ntohl(len);
+		if (len > SERVER_MAX_MSG){
+			syslog(LOG_NOTICE, "Request too long, closing client\n");
+			return -1;
+		}
+		if (c->in_len < 4 + len)
+			break;
+
+		memcpy(request, c->in + 4, len);
+		request[len] = '\0';
+		c->in_len -= 4 + len;
+		memmove(c->in, c->in + 4 + len, c->in_len);
+		c->msg_start = time(NULL);
+
+		if (answer(c, request, handler) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Read what the client sent and handle all complete requests */
+static int read_client(CLIENT *c, server_handler handler)
+{
+	ssize_t n;
+
+	if (c->packet)
+		return read_packets(c, handler);
+
+	while (!c->later){
+		n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return 0;
+		if (n <= 0)
+			return -1;
+
+		if (c->in_len == 0)
+			time(&c->msg_start);
+		c->in_len += n;
+
+		if (handle_input(c, handler) != 0)
+			return -1;
+	}
+	return 0;
+}
+
+/* Queue the reply of the request answered later and go on with the
+ * requests that came meanwhile */
+static int finish_later(CLIENT *c, server_handler handler)
+{
+	c->later = 0;
+	if (c->fd < 0)
+		return 0;		// closed meanwhile, the slot is free now
+	time(&c->last_active);
+	if (queue_reply(c, c->pending.reply, c->pending.len) != 0)
+		return -1;
+	// a packet client still has them in its socket
+	if (handle_input(c, handler) != 0)
+		return -1;
+	watch(c, c->out_len > 0);
+	return 0;
+}
+
+/* Local clients have to run as root or as the user of the daemon */
+static int peer_allowed(int conn)
+{
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) != 0)
+		return 0;
+	if (cred.uid == 0 || cred.uid == geteuid())
+		return 1;
+	syslog(LOG_NOTICE, "Refused local client pid %d uid %d\n",
+	       (int)cred.pid, (int)cred.uid);
+	return 0;
+}
+
+static void accept_client(int fd, int type)
+{
+	struct epoll_event ev;
+	CLIENT *c;
+	int conn;
+
+	conn = accept(fd, NULL, NULL);
+	if (conn < 0)
+		return;
+	if (type == SOCK_SEQPACKET && !peer_allowed(conn)){
+		close(conn);
+		return;
+	}
+
+	c = free_client();
+	if (c == NULL){
+		syslog(LOG_NOTICE, "Too many clients, connection refused\n");
+		close(conn);
+		return;
+	}
+	set_nonblock(conn);
+	c->fd = conn;
+	c->in_len = 0;
+	c->out_len = 0;
+	c->subscribed = 0;
+	c->packet = type == SOCK_SEQPACKET;
+	time(&c->last_active);
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = conn;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, conn, &ev);
+	syslog(LOG_INFO, "Socket connection accepted");
+}
+
+/* Drop idle clients and clients that stopped in the middle of a request.
+ * Subscribers may stay quiet as long as they read the feed, a client
+ * waiting for a reply as long as it takes. */
+static void check_timeouts(void)
+{
+	time_t now = time(NULL);
+	int i;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++){
+		if (clients[i].fd < 0 || clients[i].later)
+			continue;
+		if ((now - clients[i].last_active > SERVER_IDLE_TIMEOUT
+		     && !clients[i].subscribed)
+		    || (clients[i].in_len > 0
+			&& now - clients[i].msg_start > SERVER_MSG_TIMEOUT)){
+			syslog(LOG_INFO, "Client timed out\n");
+			close_client(&clients[i]);
+		}
+	}
+}
+
+int server_init(void)
+{
+	struct epoll_event ev;
+	sigset_t mask;
+	int i;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++){
+		clients[i].fd = -1;
+		clients[i].later = 0;
+	}
+
+	// signals are only delivered through the signalfd
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+		return -1;
+	sigfd = signalfd(-1, &mask, SFD_NONBLOCK);
+	if (sigfd < 0)
+		return -1;
+
+	epfd = epoll_create1(0);
+	if (epfd < 0 || pubsub_init() != 0)
+		return -1;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = pubsub_fd();
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, pubsub_fd(), &ev) != 0)
+		return -1;
+
+	// replies of requests answered later
+	done_fd = eventfd(0, EFD_NONBLOCK);
+	ev.data.fd = done_fd;
+	if (done_fd < 0 || epoll_ctl(epfd, EPOLL_CTL_ADD, done_fd, &ev) != 0)
+		return -1;
+
+	ev.data.fd = sigfd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+}
+
+int server_listen(int fd)
+{
+	struct epoll_event ev;
+	socklen_t len = sizeof(int);
+
+	if (n_listen == MAX_LISTEN)
+		return -1;
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &listen_types[n_listen], &len) != 0)
+		return -1;
+	set_nonblock(fd);
+	listen_fds[n_listen++] = fd;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev);
+}
+
+int server_run(server_handler handler, int *keep_running)
+{
+	struct epoll_event events[MAX_EVENTS];
+	struct signalfd_siginfo si;
+	uint64_t events_queued;
+	CLIENT *c;
+	int n, i, j, fd, is_listen;
+
+	while (*keep_running == 1){
+		n = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+		if (n < 0 && errno != EINTR){
+			syslog(LOG_ERR, "epoll_wait failed\n");
+			return -1;
+		}
+
+		for (i = 0; i < n; i++){
+			fd = events[i].data.fd;
+
+			if (fd == sigfd){
+				if (read(sigfd, &si, sizeof(si)) == sizeof(si))
+					syslog(LOG_NOTICE, "Got signal %u.\n", si.ssi_signo);
+				return 0;
+			}
+
+			if (fd == done_fd){
+				if (read(fd, &events_queued, sizeof(events_queued)) < 0)
+					continue;
+				for (j = 0; j < SERVER_MAX_CLIENTS; j++)
+					if (clients[j].later
+					    && __atomic_load_n(&clients[j].pending.done,
+							       __ATOMIC_ACQUIRE)
+					    && finish_later(&clients[j], handler) != 0)
+						close_client(&clients[j]);
+				continue;
+			}
+
+			if (fd == pubsub_fd()){
+				if (read(fd, &events_queued, sizeof(events_queued)) < 0)
+					continue;
+				for (j = 0; j < SERVER_MAX_CLIENTS; j++)
+					if (clients[j].fd >= 0 && clients[j].subscribed
+					    && deliver(&clients[j]) != 0)
+						close_client(&clients[j]);
+				continue;
+			}
+
+			is_listen = 0;
+			for (j = 0; j < n_listen; j++)
+				if (fd == listen_fds[j]){
+					accept_client(fd, listen_types[j]);
+					is_listen = 1;
+				}
+			if (is_listen)
+				continue;
+
+			if ((c = find_client(fd)) == NULL)
+				continue;
+			if (events[i].events & (EPOLLERR | EPOLLHUP)
+			    && !(events[i].events & EPOLLIN)){
+				close_client(c);
+				continue;
+			}
+			if (events[i].events & EPOLLOUT
+			    && (c->subscribed ? deliver(c) : flush_client(c)) != 0){
+				close_client(c);
+				continue;
+			}
+			if (events[i].events & EPOLLIN && read_client(c, handler) != 0)
+				close_client(c);
+		}
+
+		check_timeouts();
+	}
+	return 0;
+}
+
+void server_done(SERVER_PENDING *pending, int len)
+{
+	uint64_t one = 1;
+
+	pending->len = len;
+	__atomic_store_n(&pending->done, 1, __ATOMIC_RELEASE);
+	// fails only if the counter overflows, the server is woken up anyway
+	if (write(done_fd, &one, sizeof(one)) < 0)
+		syslog(LOG_DEBUG, "server: eventfd write failed\n");
+}
+
+/* done_fd stays open, a request on the device may still finish */
+void server_close(void)
+{
+	int i;
+
+	for (i = 0; i < SERVER_MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0)
+			close_client(&clients[i]);
+	for (i = 0; i < n_listen; i++)
+		close(listen_fds[i]);
+	n_listen = 0;
+	close(sigfd);
+	close(epfd);
+}
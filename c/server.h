@@ -0,0 +1,64 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/* Control server of attrracd.
+ *
+ * Clients keep their connection open and may send any number of
+ * requests. Every message in both directions is a 4 byte length in
+ * network byte order followed by that many bytes of text:
+ *	request:	"<command> [arg1] [arg2]"
+ *	reply:		"OK [values]" or "ERR <status>"
+ * Requests of one client are answered in order.
+ *
+ * Local clients can also connect to the AF_UNIX SOCK_SEQPACKET socket
+ * SOCKET_PATH. There every packet is one message and has no length in
+ * front. Only root and the user of the daemon are accepted there.
+ *
+ * "subscribe <topic> [every]" turns the connection into a live feed of
+ * the slow loop (see pubsub.h). Feed messages are framed the same way
+ * and start with "PUB <topic>", between them the client still gets the
+ * replies to its requests. "unsubscribe" ends the feed.
+ */
+
+#define SERVER_PORT		1111
+#define SERVER_MAX_CLIENTS	32
+#define SERVER_MAX_MSG		1024	// max length of a request or reply
+#define SERVER_OUT_BUF		(16*1024)	// pending replies per client
+#define SERVER_IDLE_TIMEOUT	600	// s without a request
+#define SERVER_MSG_TIMEOUT	10	// s to complete a started request
+
+// A request that has to wait, e.g. for the device, is answered later so
+// the server goes on with the other clients. The handler returns
+// SERVER_LATER and calls server_done from any thread once the reply is
+// in pending. The next requests of the client wait until then.
+#define SERVER_LATER		-1
+
+typedef struct{
+	char	reply[SERVER_MAX_MSG];
+	int	len;
+	int	done;			// set by server_done
+} SERVER_PENDING;
+
+// Handles one request and writes the reply text to reply. Returns the
+// length of the reply or SERVER_LATER.
+typedef int (*server_handler)(char *request, char *reply, int reply_size,
+			      SERVER_PENDING *pending);
+
+// Create the epoll instance and a signalfd for SIGINT and SIGTERM. The
+// signals are blocked, so call this before any thread is started.
+int server_init(void);
+
+// Accept clients on the listening socket fd, SOCK_STREAM or SOCK_SEQPACKET
+int server_listen(int fd);
+
+// Serve clients until a signal arrives or *keep_running becomes 0
+int server_run(server_handler handler, int *keep_running);
+
+// The reply of len bytes in pending is ready, called by the thread that
+// answered a request with SERVER_LATER
+void server_done(SERVER_PENDING *pending, int len);
+
+// Close all clients and the server
+void server_close(void);
+
+#endif /* SERVER_H */
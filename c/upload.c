@@ -0,0 +1,96 @@
+/*
+ * upload.c - Message helpers shared by uploader and receiver
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#include "upload.h"
+
+int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0){
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+int read_all(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+	ssize_t n;
+
+	while (len > 0){
+		n = read(fd, p, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+static void put_u32(unsigned char *p, uint32_t v)
+{
+	v = htonl(v);
+	memcpy(p, &v, 4);
+}
+
+static uint32_t get_u32(unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return ntohl(v);
+}
+
+int up_send(int fd, uint32_t type, uint32_t id, uint64_t value,
+	    const void *payload, uint32_t length)
+{
+	unsigned char buf[UP_HEADER_SIZE];
+
+	put_u32(buf, type);
+	put_u32(buf + 4, id);
+	put_u32(buf + 8, length);
+	put_u32(buf + 12, (uint32_t)(value >> 32));
+	put_u32(buf + 16, (uint32_t)value);
+
+	if (write_all(fd, buf, UP_HEADER_SIZE) != 0)
+		return -1;
+	if (length > 0 && write_all(fd, payload, length) != 0)
+		return -1;
+	return 0;
+}
+
+int up_recv(int fd, UP_HEADER *h)
+{
+	unsigned char buf[UP_HEADER_SIZE];
+
+	if (read_all(fd, buf, UP_HEADER_SIZE) != 0)
+		return -1;
+
+	h->type = get_u32(buf);
+	h->id = get_u32(buf + 4);
+	h->length = get_u32(buf + 8);
+	h->value = ((uint64_t)get_u32(buf + 12) << 32) | get_u32(buf + 16);
+	return 0;
+}
+
+int up_valid_name(const char *name)
+{
+	return name[0] != '\0' && name[0] != '.' && strchr(name, '/') == NULL
+	       && strlen(name) < UP_NAME_MAX;
+}
@@ -0,0 +1,65 @@
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <stdint.h>
+
+/* Protocol between uploader (on the SBC) and receiver (on the server).
+ *
+ * All messages start with a header of UP_HEADER_SIZE bytes, fields in
+ * network byte order:
+ *	uint32 type	UP_OFFER, UP_RESUME, ...
+ *	uint32 id	slot of the file in the current batch
+ *	uint32 length	number of payload bytes following the header
+ *	uint64 value	file size or offset, depending on type
+ *
+ * A batch of up to UP_BATCH_FILES files is sent with two round trips:
+ *	uploader			receiver
+ *	OFFER(id, size, name) ...  -->
+ *				   <--	RESUME(id, offset) ...
+ *	DATA(id, chunk) ...
+ *	END(id, size) ...	   -->
+ *				   <--	ACK(id, size) | NAK(id, offset) ...
+ * The receiver writes into a hidden partial file ".name.part" and
+ * renames it to "name" after fsync, before the ACK is sent. A partial
+ * file survives a lost connection, so the next OFFER is answered with
+ * its size and the transfer resumes there. The uploader deletes a file
+ * only after it got the ACK for it.
+ */
+
+#define UPLOAD_PORT		2222
+
+#define UP_OFFER		1	// payload: file name
+#define UP_RESUME		2	// value: offset to continue from
+#define UP_DATA			3	// payload: file content
+#define UP_END			4	// value: size of the file
+#define UP_ACK			5	// value: size of the stored file
+#define UP_NAK			6	// value: offset the receiver has
+
+#define UP_HEADER_SIZE		20
+#define UP_NAME_MAX		64	// max file name length incl. '\0'
+#define UP_CHUNK_SIZE		(64*1024)
+#define UP_BATCH_FILES		32
+
+typedef struct{
+	uint32_t	type;
+	uint32_t	id;
+	uint32_t	length;
+	uint64_t	value;
+} UP_HEADER;
+
+// Write / read exactly len bytes. Return 0 on success, -1 on error or
+// when the connection was closed.
+int write_all(int fd, const void *buf, size_t len);
+int read_all(int fd, void *buf, size_t len);
+
+// Send a message with optional payload
+int up_send(int fd, uint32_t type, uint32_t id, uint64_t value,
+	    const void *payload, uint32_t length);
+
+// Receive a message header. The payload has to be read by the caller.
+int up_recv(int fd, UP_HEADER *h);
+
+// Check that a file name from the peer is a plain, visible file name
+int up_valid_name(const char *name);
+
+#endif /* UPLOAD_H */
@@ -0,0 +1,381 @@
+/*
+ * uploader.c - Send the files in OUTBOX_DIR to the receiver on the
+ * data server over one persistent TCP connection.
+ *
+ * Usage: uploader <server> [port] [dir]
+ *
+ * The receiver only listens on localhost, server is the local end of an
+ * ssh tunnel to it, e.g. "ssh -L 2222:127.0.0.1:2222 server".
+ *
+ * Files are sent in batches (see upload.h) and only deleted when the
+ * receiver confirmed that they are stored. Only complete files show up
+ * in OUTBOX_DIR (see publish_file in data_writer.c), hidden files are
+ * still being written and are skipped. A file is claimed by renaming it
+ * to OUTBOX_CLAIM_PREFIX<name> while it is sent, so that the quota of
+ * the daemon does not compact or delete it under our feet. A file the
+ * receiver rejects is left in the outbox and offered again after
+ * REJECT_RETRY.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <dirent.h>
+#include <syslog.h>
+#include <signal.h>
+#include <netdb.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "attrracd.h"
+#include "upload.h"
+#include "outbox.h"
+
+#define POLL_INTERVAL		10	// s to wait if the outbox is empty
+#define RECONNECT_MIN		5	// s to wait before reconnecting ...
+#define RECONNECT_MAX		300	// ... doubled up to this value
+#define SOCKET_TIMEOUT		60	// s until a stalled connection is dropped
+#define REJECT_RETRY		3600	// s until a rejected file is offered again
+
+typedef struct{
+	char	name[UP_NAME_MAX];
+	int	prio;			// see outbox.h
+	time_t	mtime;
+	long	size;
+	long	offset;			// where the receiver wants us to start
+	int	fd;
+	char	claim[UP_NAME_MAX + sizeof(OUTBOX_CLAIM_PREFIX)];
+} UP_FILE;
+
+/* Files the receiver rejected, e.g. because it has another file of the
+ * same name. They are skipped, so they do not take the front of every
+ * batch. */
+typedef struct{
+	char	name[UP_NAME_MAX];
+	time_t	since;
+} REJECTED;
+
+static REJECTED *rejected = NULL;
+static int n_rejected = 0, size_rejected = 0;
+
+/* flag changed by SIGINT / SIGTERM */
+static volatile sig_atomic_t keep_running = 1;
+
+static void handle_signal(int sig)
+{
+	keep_running = 0;
+}
+
+/* Highest priority first, oldest first within a priority class, so
+ * that the server gets the data in order */
+static int cmp_file(const void *a, const void *b)
+{
+	const UP_FILE *fa = a;
+	const UP_FILE *fb = b;
+
+	if (fa->prio != fb->prio)
+		return fa->prio - fb->prio;
+	if (fa->mtime != fb->mtime)
+		return fa->mtime < fb->mtime ? -1 : 1;
+	return strcmp(fa->name, fb->name);
+}
+
+/* Forget the rejections older than REJECT_RETRY */
+static void expire_rejected(time_t now)
+{
+	int i = 0;
+
+	while (i < n_rejected)
+		if (now - rejected[i].since >= REJECT_RETRY)
+			rejected[i] = rejected[--n_rejected];
+		else
+			i++;
+}
+
+static int is_rejected(const char *name)
+{
+	int i;
+
+	for (i = 0; i < n_rejected; i++)
+		if (strcmp(rejected[i].name, name) == 0)
+			return 1;
+	return 0;
+}
+
+/* Skip name until REJECT_RETRY has passed, it is logged once */
+static void reject(const char *name, unsigned long long have)
+{
+	if (is_rejected(name))
+		return;
+	if (n_rejected == size_rejected){
+		size_rejected = size_rejected ? 2*size_rejected : 16;
+		rejected = realloc(rejected, size_rejected*sizeof(REJECTED));
+	}
+	strcpy(rejected[n_rejected].name, name);
+	time(&rejected[n_rejected].since);
+	n_rejected++;
+	syslog(LOG_NOTICE, "Receiver rejected %s at %llu, retry in %d s",
+	       name, have, REJECT_RETRY);
+}
+
+/* Collect up to max files from the current dir. Returns the number of
+ * files. */
+static int scan_outbox(UP_FILE *files, int max)
+{
+	UP_FILE *all = NULL;
+	int n = 0, size = 0;
+	DIR *d;
+	struct dirent *entry;
+	struct stat st;
+
+	if ((d = opendir(".")) == NULL){
+		syslog(LOG_ERR, "Could not read outbox");
+		return 0;
+	}
+	expire_rejected(time(NULL));
+	while ((entry = readdir(d)) != NULL){
+		if (!up_valid_name(entry->d_name) || is_rejected(entry->d_name))
+			continue;
+		if (stat(entry->d_name, &st) != 0 || !S_ISREG(st.st_mode))
+			continue;
+		if (n == size){
+			size = size ? 2*size : 64;
+			all = realloc(all, size*sizeof(UP_FILE));
+		}
+		strcpy(all[n].name, entry->d_name);
+		all[n].prio = outbox_priority(entry->d_name);
+		all[n].mtime = st.st_mtime;
+		all[n].size = st.st_size;
+		n++;
+	}
+	closedir(d);
+
+	qsort(all, n, sizeof(UP_FILE), cmp_file);
+	if (n > max)
+		n = max;
+	memcpy(files, all, n*sizeof(UP_FILE));
+	free(all);
+	return n;
+}
+
+/* Give back the files claimed by an uploader that was killed */
+static void release_claims(void)
+{
+	DIR *d;
+	struct dirent *entry;
+	int len = strlen(OUTBOX_CLAIM_PREFIX);
+
+	if ((d = opendir(".")) == NULL)
+		return;
+	while ((entry = readdir(d)) != NULL)
+		if (strncmp(entry->d_name, OUTBOX_CLAIM_PREFIX, len) == 0
+		    && up_valid_name(entry->d_name + len))
+			rename(entry->d_name, entry->d_name + len);
+	closedir(d);
+}
+
+static int connect_server(char *server, char *port)
+{
+	struct addrinfo hints, *res, *r;
+	struct timeval tv = {SOCKET_TIMEOUT, 0};
+	int fd = -1, on = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(server, port, &hints, &res) != 0){
+		syslog(LOG_ERR, "Could not resolve %s", server);
+		return -1;
+	}
+	for (r = res; r != NULL; r = r->ai_next){
+		fd = socket(r->ai_family, r->ai_socktype, r->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (connect(fd, r->ai_addr, r->ai_addrlen) == 0)
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	return fd;
+}
+
+/* Send the rest of a file starting at f->offset */
+static int send_file(int sock, UP_FILE *f, int id, char *buf)
+{
+	long pos = f->offset;
+	ssize_t n;
+
+	if (lseek(f->fd, pos, SEEK_SET) != pos)
+		return -1;
+	while (pos < f->size){
+		n = read(f->fd, buf, UP_CHUNK_SIZE);
+		if (n <= 0)
+			return -1;
+		if (pos + n > f->size)
+			n = f->size - pos;
+		if (up_send(sock, UP_DATA, id, 0, buf, n) != 0)
+			return -1;
+		pos += n;
+	}
+	return up_send(sock, UP_END, id, f->size, NULL, 0);
+}
+
+/* Send one batch of files. Returns the number of files confirmed by the
+ * receiver or -1 if the connection broke. */
+static int send_batch(int sock, UP_FILE *files, int n, char *buf)
+{
+	UP_HEADER h;
+	int i, confirmed = 0, status = 0;
+
+	// claim and open all files first, a file that vanished (deleted or
+	// compacted by the quota) is simply not offered
+	for (i = 0; i < n; i++){
+		snprintf(files[i].claim, sizeof(files[i].claim), "%s%s",
+			 OUTBOX_CLAIM_PREFIX, files[i].name);
+		files[i].fd = -1;
+		if (rename(files[i].name, files[i].claim) != 0)
+			continue;
+		files[i].fd = open(files[i].claim, O_RDONLY);
+		if (files[i].fd < 0)
+			rename(files[i].claim, files[i].name);
+	}
+
+	// offers
+	for (i = 0; i < n && status == 0; i++){
+		if (files[i].fd < 0)
+			continue;
+		status = up_send(sock, UP_OFFER, i, files[i].size,
+				 files[i].name, strlen(files[i].name) + 1);
+	}
+	// resume offsets
+	for (i = 0; i < n && status == 0; i++){
+		if (files[i].fd < 0)
+			continue;
+		if (up_recv(sock, &h) != 0 || h.type != UP_RESUME || h.id != i){
+			status = -1;
+			break;
+		}
+		files[i].offset = h.value > files[i].size ? 0 : h.value;
+	}
+	// data
+	for (i = 0; i < n && status == 0; i++){
+		if (files[i].fd < 0)
+			continue;
+		status = send_file(sock, &files[i], i, buf);
+	}
+	// acknowledgements, delete only what the receiver stored
+	for (i = 0; i < n && status == 0; i++){
+		if (files[i].fd < 0)
+			continue;
+		if (up_recv(sock, &h) != 0 || h.id != i){
+			status = -1;
+			break;
+		}
+		if (h.type == UP_ACK && h.value == files[i].size){
+			unlink(files[i].claim);
+			close(files[i].fd);
+			files[i].fd = -1;
+			confirmed++;
+		}
+		else
+			reject(files[i].name, (unsigned long long)h.value);
+	}
+
+	// give back what was not stored
+	for (i = 0; i < n; i++)
+		if (files[i].fd >= 0){
+			close(files[i].fd);
+			rename(files[i].claim, files[i].name);
+		}
+
+	return status == 0 ? confirmed : -1;
+}
+
+int main(int argc, char *argv[])
+{
+	char *server, *port, *dir = OUTBOX_DIR;
+	char default_port[8];
+	UP_FILE files[UP_BATCH_FILES];
+	char *buf;
+	int sock = -1, n, confirmed;
+	int wait = RECONNECT_MIN;
+	struct sigaction sa;
+
+	if (argc < 2){
+		printf("Usage: %s <server> [port] [dir]\n", argv[0]);
+		return 1;
+	}
+	server = argv[1];
+	snprintf(default_port, sizeof(default_port), "%d", UPLOAD_PORT);
+	port = default_port;
+	if (argc > 2)
+		port = argv[2];
+	if (argc > 3)
+		dir = argv[3];
+
+	if (chdir(dir) != 0){
+		printf("Could not change to %s\n", dir);
+		return 1;
+	}
+
+	openlog("uploader", LOG_PID | LOG_PERROR, LOG_USER);
+	release_claims();
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	buf = malloc(UP_CHUNK_SIZE);
+
+	while (keep_running){
+		n = scan_outbox(files, UP_BATCH_FILES);
+		if (n == 0){
+			sleep(POLL_INTERVAL);
+			continue;
+		}
+
+		if (sock < 0){
+			sock = connect_server(server, port);
+			if (sock < 0){
+				syslog(LOG_NOTICE, "Could not connect to %s:%s, "
+				       "retry in %d s", server, port, wait);
+				sleep(wait);
+				wait = wait*2 > RECONNECT_MAX ? RECONNECT_MAX : wait*2;
+				continue;
+			}
+			syslog(LOG_INFO, "Connected to %s:%s", server, port);
+			wait = RECONNECT_MIN;
+		}
+
+		confirmed = send_batch(sock, files, n, buf);
+		if (confirmed < 0){
+			syslog(LOG_NOTICE, "Connection to %s lost", server);
+			close(sock);
+			sock = -1;
+		}
+		else if (confirmed < n){
+			// receiver rejected files, do not hammer it
+			sleep(POLL_INTERVAL);
+		}
+	}
+
+	if (sock >= 0)
+		close(sock);
+	free(buf);
+	closelog();
+	return 0;
+}
@@ -13,7 +13,16 @@
 #include "helper.h"
 #include "ftd2xx.h"
 #include "usb_control.h"
+#include "data_writer.h"
+#include "fusion.h"
+#include "pubsub.h"
+#include "device.h"
 
+// Flag that keeps the slow loop running as long as it is 1
+int slow_loop_keep_running = 0;
+long slow_loop_gaps = 0;
+double slow_loop_last_gap = 0;
+double slow_loop_max_gap = 0;
 
 
 /***********************/
@@ -152,6 +161,16 @@ int write_bytes(FT_HANDLE ftHandle, char *bytes, int size)
 /* COMMAND INTERFACE FUNCTIONS */
 /*******************************/
 
+// Set USB timeouts so that they fit to n_samples
+static void set_timeouts(FT_HANDLE ftHandle, int n_samples)
+{
+	int sampl_freq = 25000; // in Hz
+	int tout = ceil(1000*n_samples/sampl_freq)+500; // in miliseconds
+	if (tout < 3000) tout = 3000;
+	FT_SetTimeouts(ftHandle, tout, tout);
+	syslog(LOG_NOTICE, "Set timeout to %d\n", tout);
+}
+
 // Set the number of samples for the measurement
 int set_num_samples(FT_HANDLE ftHandle, int n_samples)
 {
@@ -190,12 +209,7 @@ int set_num_samples(FT_HANDLE ftHandle, int n_samples)
 	if (status != OK)  			return status;
 	if (uC_status != DONE)		return uC_ERR;
 	
-	// Set USB timeouts so that they fit to n_samples
-	int sampl_freq = 25000; // in Hz
-	int tout = ceil(1000*n_samples/sampl_freq)+500; // in miliseconds
-	if (tout < 3000) tout = 3000;
-	FT_SetTimeouts(ftHandle, tout, tout);
-	syslog(LOG_NOTICE, "Set timeout to %d\n", tout);
+	set_timeouts(ftHandle, n_samples);
 
 	return OK;
 }
@@ -392,7 +406,7 @@ int set_pol_precede(FT_HANDLE ftHandle, int int_precede)
 }
 
 // Get status from CPLD (lock bits from PLOs)
-int get_status(FT_HANDLE ftHandle)
+int get_status(FT_HANDLE ftHandle, int *value)
 {
 	char cpld_status;
 	int status = OK;
@@ -408,7 +422,7 @@ int get_status(FT_HANDLE ftHandle)
 	if (status != OK)  			return status;
 	
 	syslog(LOG_NOTICE, "CPLD status = %.d \n", cpld_status);
-	syslog(LOG_NOTICE, "CPLD status = %.d \n", cpld_status);
+	*value = (unsigned char)cpld_status;
 	
 	return OK;
 }
@@ -514,6 +528,222 @@ int set_atten35(FT_HANDLE ftHandle, int atten1, int atten2)
 }
 
 
+int check_pulse_conf(PULSE_CONF *conf, int loop_freq, int mask)
+{
+	int m = conf->mode;
+	
+	if (mask & 1<<CONF_N_SAMPLES && (conf->n_samples <= 0
+	    || conf->n_samples > 4000000 || conf->n_samples%2 != 0))
+		return ARG_ERR;
+	if (mask & 1<<CONF_PW && (conf->pw < 0 || conf->pw > 255))
+		return ARG_ERR;
+	if (mask & 1<<CONF_DELAY && (conf->delay < 0 || conf->delay > 500))
+		return ARG_ERR;
+	if (mask & 1<<CONF_POL_PRECEDE
+	    && (conf->pol_preced < 0 || conf->pol_preced > 255))
+		return ARG_ERR;
+	if (mask & 1<<CONF_ADC_DELAY
+	    && (conf->adc_delay < 0 || conf->adc_delay > 255))
+		return ARG_ERR;
+	if (mask & 1<<CONF_MODE && m != CROSSPOL && m != COPOL
+	    && m != CALIBRATE && m != RADIOMETER)
+		return ARG_ERR;
+	if (mask & 1<<CONF_ATTEN22
+	    && (conf->atten22_1 < 0 || conf->atten22_1 > 31
+		|| conf->atten22_2 < 0 || conf->atten22_2 > 31))
+		return ARG_ERR;
+	if (mask & 1<<CONF_ATTEN35
+	    && (conf->atten35_1 < 0 || conf->atten35_1 > 31
+		|| conf->atten35_2 < 0 || conf->atten35_2 > 31))
+		return ARG_ERR;
+	if (mask & 1<<CONF_LOOP_FREQ
+	    && loop_freq != 5 && loop_freq != 10 && loop_freq != 20)
+		return ARG_ERR;
+	
+	// the receive window has to start after the TX pulse. A delay of 0
+	// has never been set, pw alone is not checked against it.
+	if ((mask & 1<<CONF_DELAY || (mask & 1<<CONF_PW && conf->delay != 0))
+	    && conf->delay < conf->pw + 5){
+		syslog(LOG_NOTICE, "Delay must be at least pw+5\n");
+		return ARG_ERR;
+	}
+	return OK;
+}
+
+// Read n bytes of a reply
+static int read_reply(FT_HANDLE ftHandle, char *buf, int n)
+{
+	DWORD dwBytesRead;
+	
+	if (FT_Read(ftHandle, buf, n, &dwBytesRead) != FT_OK
+	    || dwBytesRead != n){
+		syslog(LOG_NOTICE, "No reply. Timeout\n");
+		return USB_ERR;
+	}
+	return OK;
+}
+
+int set_pulse_conf(FT_HANDLE ftHandle, PULSE_CONF *conf, int loop_freq,
+		   int mask, int *results)
+{
+	char cmds[CONF_FIELDS*5];	// command byte and up to 3 value bytes
+	int start[CONF_FIELDS], len[CONF_FIELDS];
+	char num[4], reply[5];
+	unsigned char uC_status;
+	int n = 0, f, i, status = OK, stream_ok = 1;
+	DWORD dwBytesWritten;
+	
+	// all command bytes in the order of the fields
+	for (f = 0; f < CONF_FIELDS; f++){
+		start[f] = n;
+		if (!(mask & 1<<f))
+			continue;
+		switch (f){
+		case CONF_N_SAMPLES:
+			int_to_bytes(conf->n_samples, num);
+			cmds[n++] = SET_NUM_SAMPLES;
+			cmds[n++] = num[0];
+			cmds[n++] = num[1];
+			cmds[n++] = num[2];
+			break;
+		case CONF_PW:
+			cmds[n++] = SET_PW;
+			cmds[n++] = (char)conf->pw;
+			break;
+		case CONF_DELAY:
+			int_to_bytes(conf->delay, num);
+			cmds[n++] = SET_DELAY;
+			cmds[n++] = num[0];
+			cmds[n++] = num[1];
+			break;
+		case CONF_POL_PRECEDE:
+			cmds[n++] = SET_POL_PRECEDE;
+			cmds[n++] = (char)conf->pol_preced;
+			break;
+		case CONF_ADC_DELAY:
+			cmds[n++] = SET_ADC;
+			cmds[n++] = (char)conf->adc_delay;
+			break;
+		case CONF_MODE:
+			cmds[n++] = SET_MODE;
+			cmds[n++] = (char)conf->mode;
+			break;
+		case CONF_ATTEN22:
+			cmds[n++] = SET_ATTEN22;
+			cmds[n++] = (char)conf->atten22_1;
+			cmds[n++] = (char)conf->atten22_2;
+			break;
+		case CONF_ATTEN35:
+			cmds[n++] = SET_ATTEN35;
+			cmds[n++] = (char)conf->atten35_1;
+			cmds[n++] = (char)conf->atten35_2;
+			break;
+		case CONF_LOOP_FREQ:
+			// single byte without status, see set_loop_freq
+			cmds[n++] = loop_freq == 5 ? SET_LOOP_FREQ_5 :
+				    loop_freq == 10 ? SET_LOOP_FREQ_10 :
+				    SET_LOOP_FREQ_20;
+			break;
+		}
+		len[f] = n - start[f];
+	}
+	
+	syslog(LOG_NOTICE, "Set configuration, %d bytes\n", n);
+	FT_Write(ftHandle, cmds, n, &dwBytesWritten);
+	
+	// Every command is echoed, then comes OK and DONE or CPLD_BUSY.
+	// After a broken echo the replies can not be matched any more. All
+	// bytes went out with one write, so the device got the remaining
+	// fields as well and may have taken them.
+	for (f = 0; f < CONF_FIELDS; f++){
+		if (!(mask & 1<<f))
+			continue;
+		if (!stream_ok){
+			results[f] = CONF_UNKNOWN;
+			continue;
+		}
+		
+		results[f] = read_reply(ftHandle, reply, len[f]);
+		for (i = 0; results[f] == OK && i < len[f]; i++)
+			if (reply[i] != cmds[start[f] + i])
+				results[f] = USB_ERR;
+		
+		if (results[f] == OK && f != CONF_LOOP_FREQ){
+			results[f] = read_reply(ftHandle, (char *)&uC_status, 1);
+			if (results[f] == OK && uC_status == CPLD_BUSY)
+				results[f] = CPLD_BUSY;
+			else if (results[f] == OK && uC_status != OK)
+				results[f] = uC_ERR;
+			else if (results[f] == OK){
+				results[f] = read_reply(ftHandle, (char *)&uC_status, 1);
+				if (results[f] == OK && uC_status != DONE)
+					results[f] = uC_ERR;
+			}
+		}
+		
+		if (results[f] != OK && results[f] != CPLD_BUSY){
+			syslog(LOG_NOTICE, "Configuration stopped at field %d\n", f);
+			FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+			stream_ok = 0;
+		}
+		if (results[f] != OK && status == OK)
+			status = results[f];
+	}
+	
+	if (mask & 1<<CONF_N_SAMPLES && results[CONF_N_SAMPLES] == OK)
+		set_timeouts(ftHandle, conf->n_samples);
+	
+	return status;
+}
+
+
+int get_pulse_conf(FT_HANDLE ftHandle, PULSE_CONF *conf, int *valid)
+{
+	unsigned char frame[CONFIG_FRAME];
+	char cmd = GET_CONFIG;
+	int status;
+	DWORD dwBytesWritten;
+	
+	FT_Write(ftHandle, &cmd, 1, &dwBytesWritten);
+	
+	// older firmware answers ERR instead of the echo
+	status = read_reply(ftHandle, (char *)frame, 1);
+	if (status != OK)			return status;
+	if (frame[0] != GET_CONFIG){
+		syslog(LOG_NOTICE, "GET_CONFIG not known by the firmware\n");
+		FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+		return uC_ERR;
+	}
+	status = read_reply(ftHandle, (char *)frame + 1, CONFIG_FRAME - 1);
+	if (status != OK)			return status;
+	if (frame[CONFIG_FRAME - 1] != DONE)	return uC_ERR;
+	
+	// same order as CONF_*, values LSB first as they were sent
+	*valid = frame[1];
+	if (*valid & 1<<CONF_N_SAMPLES)
+		conf->n_samples = frame[2] | frame[3]<<8 | frame[4]<<16;
+	if (*valid & 1<<CONF_PW)
+		conf->pw = frame[5];
+	if (*valid & 1<<CONF_DELAY)
+		conf->delay = frame[6] | frame[7]<<8;
+	if (*valid & 1<<CONF_POL_PRECEDE)
+		conf->pol_preced = frame[8];
+	if (*valid & 1<<CONF_ADC_DELAY)
+		conf->adc_delay = frame[9];
+	if (*valid & 1<<CONF_MODE)
+		conf->mode = frame[10];
+	if (*valid & 1<<CONF_ATTEN22){
+		conf->atten22_1 = frame[11];
+		conf->atten22_2 = frame[12];
+	}
+	if (*valid & 1<<CONF_ATTEN35){
+		conf->atten35_1 = frame[13];
+		conf->atten35_2 = frame[14];
+	}
+	return OK;
+}
+
+
 // obsolete??
 /*void *FT_Read_threaded(FT_HANDLE ftHandle, LPVOID pcBufRead, 
 					   DWORD read_buffer_size, LPDWORD dwBytesRead)
@@ -537,7 +767,10 @@ void *FT_Read_thread(void *args)
 	pthread_exit(NULL);
 }
 
-int start_msrmnt(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data)
+// Measure into buf of n_bytes_to_read bytes, which the caller keeps for
+// the next measurement
+int start_msrmnt_buf(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data,
+		     unsigned char *buf)
 {
 	//int i, j;
 	//unsigned char uC_status;// status returned by uC
@@ -555,7 +788,7 @@ int start_msrmnt(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data)
 	a.read_buffer_size = n_bytes_to_read;
 	a.dwBytesRead = 0;
 
-	a.pcBufRead = (unsigned char *)malloc(a.read_buffer_size);
+	a.pcBufRead = buf;
 	
 	// Send the command to start measuring
 	write_byte(ftHandle, START_MSRMNT);
@@ -592,14 +825,12 @@ int start_msrmnt(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data)
 
 	if (a.dwBytesRead < 9){
 		syslog(LOG_NOTICE, "Too few bytes (N<9) read. Error. Exiting...\n");
-		free(a.pcBufRead);
 		return ERR;
 	}
 	
 	if (a.dwBytesRead != a.read_buffer_size){
 		syslog(LOG_NOTICE, "To few bytes read. Read_buffer = %d n_bytes_read = %d\n",
 			    a.read_buffer_size, (int)a.dwBytesRead);
-		free(a.pcBufRead);
 		return ERR;
 	}
 								
@@ -623,13 +854,11 @@ int start_msrmnt(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data)
 	
 	if (diff < 20){
 		syslog(LOG_NOTICE, "too few usefull bytes found\n");
-		free(a.pcBufRead);
 		return ERR;
 	}
 	
 	if (diff % 9 != 0){
 		syslog(LOG_NOTICE, "first or last counter byte wrongly selected\n");
-		free(a.pcBufRead);
 		return ERR;
 	}
 
@@ -660,14 +889,215 @@ int start_msrmnt(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data)
 	
 	raw2_i_q_h_v_data(a.pcBufRead, data, N, first, last);
 	
-	free(a.pcBufRead);
 //	FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
 
 	return OK;
 }
 
+int start_msrmnt(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data)
+{
+	unsigned char *buf = (unsigned char *)malloc(n_bytes_to_read);
+	int status = start_msrmnt_buf(ftHandle, n_bytes_to_read, data, buf);
+
+	free(buf);
+	return status;
+}
+
+// Write the header of a slow loop file
+static void write_loop_header(FILE *loop_file, PULSE_CONF *conf)
+{
+	fprintf(loop_file, "# FILE_TYPE  = SLOW_LOOP_v2 \n");
+	fprintf(loop_file, "# n_sample   = %d \n", conf->n_samples);
+	fprintf(loop_file, "# pw         = %d \n", conf->pw);
+	fprintf(loop_file, "# delay      = %d \n", conf->delay);
+	fprintf(loop_file, "# pol_preced = %d \n", conf->pol_preced);
+	fprintf(loop_file, "# adc_delay  = %d \n", conf->adc_delay);
+	fprintf(loop_file, "#\n");
+	fprintf(loop_file, "time;            I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
+			   "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
+			   "T_case;   T_pcb;  accel1;  accel2;  resets\n");
+}
+
+// Channels summarized in the zone map of a slow loop file
+static char *loop_zone_channels[] = {
+	"I_h_35", "Q_h_35", "I_h_22", "Q_h_22",
+	"I_v_35", "Q_v_35", "I_v_22", "Q_v_22",
+	"A_h_35", "A_h_22", "A_v_35", "A_v_22",
+	"T_case", "T_pcb"
+};
+#define LOOP_ZONE_CHANNELS	14
+
+// Open a new slow loop file with timestamped filename, write the header
+// and start its zone map
+static void open_loop_file(DATA_FILE *loop_file, char *prefix, time_t t,
+			   struct thread_args *a)
+{
+	char filename[64];
+
+	data_file_name(filename, sizeof(filename), prefix, t, a->rotation);
+	data_file_open(loop_file, filename, a->rotation);
+	write_loop_header(loop_file->file, a->conf);
+	data_file_zone_enable(loop_file, loop_zone_channels,
+			      LOOP_ZONE_CHANNELS, ZONE_BLOCK_RECORDS);
+}
+
+// The firmware looks for the stop only at its next timer tick and may
+// send a record in front of the echo. The echo is the STOP byte after
+// which the device stays quiet for longer than a tick (200 ms at the
+// lowest loop frequency of 5 Hz).
+#define STOP_ECHO_QUIET		300	// ms
+#define STOP_ECHO_TIMEOUT	2	// s
+
+// Stop the slow loop and wait for the echo. Returns OK if it stopped.
+static int pause_slow_loop(FT_HANDLE ftHandle)
+{
+	struct timeval t0, t;
+	char byte, last = 0;
+	DWORD n;
+
+	if (write_byte(ftHandle, STOP_SLOW_LOOP) == OK)
+		return OK;
+
+	gettimeofday(&t0, NULL);
+	FT_SetTimeouts(ftHandle, STOP_ECHO_QUIET, STOP_ECHO_QUIET);
+	do{
+		if (FT_Read(ftHandle, &byte, 1, &n) != FT_OK)
+			break;
+		if (n == 0 && last == STOP_SLOW_LOOP){
+			FT_SetTimeouts(ftHandle, 15000, 15000);
+			return OK;
+		}
+		if (n == 1)
+			last = byte;
+		gettimeofday(&t, NULL);
+	} while (t.tv_sec - t0.tv_sec < STOP_ECHO_TIMEOUT);
+	FT_SetTimeouts(ftHandle, 15000, 15000);
+	syslog(LOG_ERR, "Slow loop did not stop, queued requests wait\n");
+	return USB_ERR;
+}
+
+// Run the operations queued for the device owner (device.h) between two
+// records. The firmware stops its loop on any byte it receives, so the
+// loop is stopped explicitly, the rest of the record in flight is purged
+// and the loop is started again afterwards. The gap in the loop is
+// written to the file as "# gap <time>; <seconds>". If the loop does
+// not stop, the operations wait for the next record.
+static void serve_device_queue(FT_HANDLE ftHandle, DATA_FILE *loop_file)
+{
+	struct timeval t_stop, t_start;
+
+	if (!device_pending())
+		return;
+
+	gettimeofday(&t_stop, NULL);
+	if (pause_slow_loop(ftHandle) != OK)
+		return;
+	FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+	FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
+
+	device_serve();
+
+	if (slow_loop_keep_running != 1)
+		return;
+	write_byte(ftHandle, START_SLOW_LOOP);
+	gettimeofday(&t_start, NULL);
+
+	slow_loop_gaps++;
+	slow_loop_last_gap = (t_start.tv_sec - t_stop.tv_sec)
+			     + (t_start.tv_usec - t_stop.tv_usec)/1e6;
+	if (slow_loop_last_gap > slow_loop_max_gap)
+		slow_loop_max_gap = slow_loop_last_gap;
+	fprintf(loop_file->file, "# gap %ld.%03ld; %.3f\n", t_stop.tv_sec,
+		t_stop.tv_usec/1000, slow_loop_last_gap);
+}
+
+// Live feed: "PUB stats <t> <14 values>" in the order of the zone map,
+// "PUB stats <t> glitch" for a failed burst
+static void publish_stats(double t, double *v)
+{
+	char msg[PUBSUB_MSG_SIZE];
+	int i, len;
+
+	len = snprintf(msg, sizeof(msg), "PUB stats %.3f", t);
+	if (v == NULL)
+		len += snprintf(msg + len, sizeof(msg) - len, " glitch");
+	for (i = 0; v != NULL && i < LOOP_ZONE_CHANNELS; i++)
+		len += snprintf(msg + len, sizeof(msg) - len, " %.2f", v[i]);
+	pubsub_publish(PUBSUB_STATS, msg, len);
+}
+
+// Live feed: "PUB iq <t> <N> <step>" followed by one line per channel
+// (h_i_35 h_q_35 h_i_22 h_q_22 v_i_35 v_q_35 v_i_22 v_q_22) with every
+// step-th sample, at most PUBSUB_IQ_SAMPLES per channel
+static void publish_iq(double t, DATA_STRUCT *data)
+{
+	DATA_POINTS *ch[8] = {data->h_i_35, data->h_q_35, data->h_i_22, data->h_q_22,
+			      data->v_i_35, data->v_q_35, data->v_i_22, data->v_q_22};
+	char msg[PUBSUB_MSG_SIZE];
+	int step = (data->N + PUBSUB_IQ_SAMPLES - 1) / PUBSUB_IQ_SAMPLES;
+	int i, j, len;
+
+	if (step < 1)
+		step = 1;
+	len = snprintf(msg, sizeof(msg), "PUB iq %.3f %d %d", t, data->N, step);
+	for (i = 0; i < 8 && len < sizeof(msg); i++){
+		len += snprintf(msg + len, sizeof(msg) - len, "\n");
+		for (j = 0; j < data->N && len < sizeof(msg); j += step)
+			len += snprintf(msg + len, sizeof(msg) - len, " %d",
+					ch[i]->values[j]);
+	}
+	if (len >= sizeof(msg))
+		len = sizeof(msg) - 1;
+	pubsub_publish(PUBSUB_IQ, msg, len);
+}
+
+// Add a slow loop record to the zone map and the fusion product. data is
+// NULL for a glitch.
+static void summarize_loop_record(DATA_FILE *loop_file, struct timeval *tim,
+			  DATA_STRUCT *data, double case_temp, double board_temp)
+{
+	double v[LOOP_ZONE_CHANNELS];
+	double t = tim->tv_sec + tim->tv_usec/1e6;
+
+	if (data == NULL){
+		data_file_zone_add(loop_file, t, NULL);
+		fusion_add_radar(t, NULL);
+		if (pubsub_active(PUBSUB_STATS))
+			publish_stats(t, NULL);
+		return;
+	}
+
+	v[0] = data->h_i_35->mean;
+	v[1] = data->h_q_35->mean;
+	v[2] = data->h_i_22->mean;
+	v[3] = data->h_q_22->mean;
+	v[4] = data->v_i_35->mean;
+	v[5] = data->v_q_35->mean;
+	v[6] = data->v_i_22->mean;
+	v[7] = data->v_q_22->mean;
+	v[8] = sqrt(v[0]*v[0] + v[1]*v[1]);
+	v[9] = sqrt(v[2]*v[2] + v[3]*v[3]);
+	v[10] = sqrt(v[4]*v[4] + v[5]*v[5]);
+	v[11] = sqrt(v[6]*v[6] + v[7]*v[7]);
+	v[12] = case_temp;
+	v[13] = board_temp;
+	data_file_zone_add(loop_file, t, v);
+	fusion_add_radar(t, v);
+	if (pubsub_active(PUBSUB_STATS))
+		publish_stats(t, v);
+	if (pubsub_active(PUBSUB_IQ))
+		publish_iq(t, data);
+}
+
 void *start_slow_loop(void *args)
 {
+	// Check if a slow_loop is running
+	if(slow_loop_keep_running == 1){
+		syslog(LOG_NOTICE, "Could not start slow loop. "
+				   "There is already a slow loop running\n");
+		return NULL;
+	}
+	
 	unsigned char done_message;
 	struct thread_args *a = (struct thread_args*) args;
 	FT_HANDLE ftHandle = a->ftHandle;
@@ -698,34 +1128,20 @@ void *start_slow_loop(void *args)
 	write_byte(ftHandle, START_SLOW_LOOP);
 	
 	slow_loop_keep_running = 1;
+	slow_loop_gaps = 0;
+	slow_loop_max_gap = 0;
 	
-	time_t t_now, t_old;
-	struct tm *ts;
-	int tm_min_old, tm_min_diff;
-	char filename[23], filename_old[23], sys_string[100];
+	time_t t_now;
+	DATA_FILE loop_file;
 	
 	// open file with timestamped filename
 	time(&t_now);
-	ts = gmtime(&t_now);
-	strftime(filename, 23, "loop_%Y%m%d_%H%M.dat", ts);
-	FILE *loop_file = fopen(filename,"w");
-        // Write header
-        fprintf(loop_file, "# FILE_TYPE  = SLOW_LOOP_v2 \n");
-        fprintf(loop_file, "# n_sample   = %d \n", a->conf->n_samples);
-        fprintf(loop_file, "# pw         = %d \n", a->conf->pw);
-        fprintf(loop_file, "# delay      = %d \n", a->conf->delay);
-        fprintf(loop_file, "# pol_preced = %d \n", a->conf->pol_preced);
-        fprintf(loop_file, "# adc_delay  = %d \n", a->conf->adc_delay);
-        fprintf(loop_file, "#\n");
-        fprintf(loop_file, "time;            I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
-                                            "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
-                                            "T_case;   T_pcb;  accel1;  accel2;  resets\n");
+	open_loop_file(&loop_file, "loop_", t_now, a);
         
         
 	int foo_count = 0;
 	
 	syslog(LOG_NOTICE, "Starting slow loop\n");
-	tm_min_old = ts->tm_min;
 	
 
 	// QUICK FIX
@@ -742,39 +1158,20 @@ void *start_slow_loop(void *args)
 	// loop to continuously read in bursts of n_samples
 	// as long as slow_loop_keep_running is true
 	while(slow_loop_keep_running == 1){
-		// open new file every minute
+		// open new file as requested by the rotation policy
 		time(&t_now);
-		ts = gmtime(&t_now);
-		tm_min_diff = abs(ts->tm_min - tm_min_old);
-		if(tm_min_diff != 0 && ts->tm_min%1 == 0){
-			strcpy (filename_old, filename);
-			// new filename
-			strftime(filename, 23, "loop_%Y%m%d_%H%M.dat", ts);
-			// close old file
-			fclose(loop_file);
-			// zip file to data_send directory
-			sprintf(sys_string, "gzip -c %s > /root/data_to_send/%s.gz", 
-					filename_old, filename_old);
-			system(sys_string);
-			// remove file
-			sprintf(sys_string, "rm %s", filename_old);
-			system(sys_string);
+		if(data_file_rotate_due(&loop_file, t_now)){
+			// close old file, it is zipped to the outbox
+			data_file_close(&loop_file);
 			// open new file
-			loop_file = fopen(filename,"w");
-			tm_min_old = ts->tm_min;
-			// Write header
-			fprintf(loop_file, "# FILE_TYPE  = SLOW_LOOP_v2 \n");
-			fprintf(loop_file, "# n_sample   = %d \n", a->conf->n_samples);
-			fprintf(loop_file, "# pw         = %d \n", a->conf->pw);
-			fprintf(loop_file, "# delay      = %d \n", a->conf->delay);
-			fprintf(loop_file, "# pol_preced = %d \n", a->conf->pol_preced);
-			fprintf(loop_file, "# adc_delay  = %d \n", a->conf->adc_delay);
-			fprintf(loop_file, "#\n");
-                        fprintf(loop_file, "time;            I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
-                                                            "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
-                                                            "T_case;   T_pcb;  accel1;  accel2;  resets\n");
+			open_loop_file(&loop_file, "loop_", t_now, a);
 		}
 		
+		// run requests of other threads between two records
+		serve_device_queue(ftHandle, &loop_file);
+		if (slow_loop_keep_running != 1)
+			break;
+		
 		// read in case temperature
 		// explanation see function get_case_temp
 		read_byte(ftHandle, &c_lsb);
@@ -786,8 +1183,8 @@ void *start_slow_loop(void *args)
 		// get current time
 		gettimeofday(&tim, NULL);
 		
-		//fprintf(loop_file, ctime(&tim.tv_sec));
-		fprintf(loop_file, "%ld.%03ld; ", tim.tv_sec, tim.tv_usec/1000);
+		//fprintf(loop_file.file, ctime(&tim.tv_sec));
+		fprintf(loop_file.file, "%ld.%03ld; ", tim.tv_sec, tim.tv_usec/1000);
 		
 		// read in board temperature
 		read_byte(ftHandle, &c_lsb);
@@ -832,9 +1229,11 @@ void *start_slow_loop(void *args)
 			syslog(LOG_NOTICE, "last - first is not mod 18!!\n");
 			FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
 			FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX); // safer to do this twice
-			fprintf(loop_file, 
+			fprintf(loop_file.file, 
 					"9999; 9999; 9999; 9999; 9999; 9999; 9999; 9999; % 7.1f; % 7.1f; % 7d; % 7d; % 7d\n",
 					case_temp, board_temp, accel1, accel2, reset_count);
+			summarize_loop_record(&loop_file, &tim, NULL, case_temp, board_temp);
+			data_file_record(&loop_file);
 		}
 		else{	
 			// process data
@@ -850,7 +1249,7 @@ void *start_slow_loop(void *args)
 			// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 			// ADD STANDARD DEVIATION !!!!!!
 			// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-/*			fprintf(loop_file, 
+/*			fprintf(loop_file.file, 
 			"%5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %d %d %d\n",
 						data->h_a_35->mean, data->h_p_35->mean,
 						data->h_a_22->mean, data->h_p_22->mean,  
@@ -858,13 +1257,15 @@ void *start_slow_loop(void *args)
 						data->v_a_22->mean, data->v_p_22->mean,
 						case_temp, board_temp, accel1, accel2, reset_count);
 */
-			fprintf(loop_file, 
+			fprintf(loop_file.file, 
  			"% 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7d; % 7d; % 7d\n",
  						data->h_i_35->mean, data->h_q_35->mean,
  						data->h_i_22->mean, data->h_q_22->mean,  
  						data->v_i_35->mean, data->v_q_35->mean,
  						data->v_i_22->mean, data->v_q_22->mean,
  						case_temp, board_temp, accel1, accel2, reset_count);
+			summarize_loop_record(&loop_file, &tim, data, case_temp, board_temp);
+			data_file_record(&loop_file);
 						
 // 			foo_count++;
 // 			if(foo_count % 20 == 0){
@@ -887,7 +1288,7 @@ void *start_slow_loop(void *args)
 
 	syslog(LOG_NOTICE, "Slow low stopped\n");
 
-	fclose(loop_file);
+	data_file_close(&loop_file);
 	free_data_struct(data);
 	free(pcBufRead);
 
@@ -949,37 +1350,17 @@ void *start_slow_loop_calibrate(void *args)
 	write_byte(ftHandle, START_SLOW_LOOP);
 
 	slow_loop_keep_running = 1;
+	slow_loop_gaps = 0;
+	slow_loop_max_gap = 0;
 
-	time_t t_now, t_old;
-	struct tm *ts;
-        struct tm *ts_old;
-	int tm_min_old, tm_min_diff;
-        int tm_sec_diff;
-	char filename[35], filename_old[35], sys_string[100];
+	time_t t_now;
+	DATA_FILE loop_file;
 
 	// open file with timestamped filename
 	time(&t_now);
-	ts = gmtime(&t_now);
-	strftime(filename, 35, "loop_calibration_%Y%m%d_%H%M.dat", ts);
-	FILE *loop_file = fopen(filename,"w");
-        // Write header
-        fprintf(loop_file, "# FILE_TYPE  = SLOW_LOOP_v2 \n");
-        fprintf(loop_file, "# n_sample   = %d \n", a->conf->n_samples);
-        fprintf(loop_file, "# pw         = %d \n", a->conf->pw);
-        fprintf(loop_file, "# delay      = %d \n", a->conf->delay);
-        fprintf(loop_file, "# pol_preced = %d \n", a->conf->pol_preced);
-        fprintf(loop_file, "# adc_delay  = %d \n", a->conf->adc_delay);
-        fprintf(loop_file, "#\n");
-        fprintf(loop_file, "time;            I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
-                                            "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
-                                            "T_case;   T_pcb;  accel1;  accel2;  resets\n");
+	open_loop_file(&loop_file, "loop_calibration_", t_now, a);
 
 	syslog(LOG_NOTICE, "Starting slow loop\n");
-	tm_min_old = ts->tm_min;
-
-        // New variable for time to have a counter at 1 second rate
-        time(&t_now);
-        ts_old = gmtime(&t_now);
 
 	// QUICK FIX
 	// With low timeout values we get many missing bytes...
@@ -997,39 +1378,20 @@ void *start_slow_loop_calibrate(void *args)
 	// as long as slow_loop_keep_running is true
 	while(slow_loop_keep_running == 1){
                 loop_count += 1;
-		// open new file every minute
+		// open new file as requested by the rotation policy
 		time(&t_now);
-		ts = gmtime(&t_now);
-		tm_min_diff = abs(ts->tm_min - tm_min_old);
-		if(tm_min_diff != 0 && ts->tm_min%1 == 0){
-			strcpy (filename_old, filename);
-			// new filename
-			strftime(filename, 35, "loop_calibration_%Y%m%d_%H%M.dat", ts);
-			// close old file
-			fclose(loop_file);
-			// zip file to data_send directory
-			sprintf(sys_string, "gzip -c %s > /root/data_to_send/%s.gz",
-					filename_old, filename_old);
-			system(sys_string);
-			// remove file
-			sprintf(sys_string, "rm %s", filename_old);
-			system(sys_string);
+		if(data_file_rotate_due(&loop_file, t_now)){
+			// close old file, it is zipped to the outbox
+			data_file_close(&loop_file);
 			// open new file
-			loop_file = fopen(filename,"w");
-			tm_min_old = ts->tm_min;
-			// Write header
-			fprintf(loop_file, "# FILE_TYPE  = SLOW_LOOP_v2 \n");
-			fprintf(loop_file, "# n_sample   = %d \n", a->conf->n_samples);
-			fprintf(loop_file, "# pw         = %d \n", a->conf->pw);
-			fprintf(loop_file, "# delay      = %d \n", a->conf->delay);
-			fprintf(loop_file, "# pol_preced = %d \n", a->conf->pol_preced);
-			fprintf(loop_file, "# adc_delay  = %d \n", a->conf->adc_delay);
-			fprintf(loop_file, "#\n");
-                        fprintf(loop_file, "time;            I_h_35;  Q_h_35;  I_h_22;  Q_h_22;  "
-                                                            "I_v_35;  Q_v_35;  I_v_22;  Q_v_22;  "
-                                                            "T_case;   T_pcb;  accel1;  accel2;  resets\n");
+			open_loop_file(&loop_file, "loop_calibration_", t_now, a);
 		}
 
+		// run requests of other threads between two records
+		serve_device_queue(ftHandle, &loop_file);
+		if (slow_loop_keep_running != 1)
+			break;
+		
 		// read in case temperature
 		// explanation see function get_case_temp
 		read_byte(ftHandle, &c_lsb);
@@ -1041,8 +1403,8 @@ void *start_slow_loop_calibrate(void *args)
 		// get current time
 		gettimeofday(&tim, NULL);
 
-		//fprintf(loop_file, ctime(&tim.tv_sec));
-		fprintf(loop_file, "%ld.%03ld; ", tim.tv_sec, tim.tv_usec/1000);
+		//fprintf(loop_file.file, ctime(&tim.tv_sec));
+		fprintf(loop_file.file, "%ld.%03ld; ", tim.tv_sec, tim.tv_usec/1000);
 
 		// read in board temperature
 		read_byte(ftHandle, &c_lsb);
@@ -1087,9 +1449,11 @@ void *start_slow_loop_calibrate(void *args)
 			syslog(LOG_NOTICE, "last - first is not mod 18!!\n");
 			FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX);
 			FT_Purge(ftHandle, FT_PURGE_RX | FT_PURGE_TX); // safer to do this twice
-			fprintf(loop_file,
+			fprintf(loop_file.file,
 					"9999; 9999; 9999; 9999; 9999; 9999; 9999; 9999; % 7.1f; % 7.1f; % 7d; % 7d; % 7d\n",
 					case_temp, board_temp, accel1, accel2, reset_count);
+			summarize_loop_record(&loop_file, &tim, NULL, case_temp, board_temp);
+			data_file_record(&loop_file);
 		}
 		else{
 			// process data
@@ -1105,7 +1469,7 @@ void *start_slow_loop_calibrate(void *args)
 			// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!
 			// ADD STANDARD DEVIATION !!!!!!
 			// !!!!!!!!!!!!!!!!!!!!!!!!!!!!!
-/*			fprintf(loop_file,
+/*			fprintf(loop_file.file,
 			"%5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %5.1f %d %d %d\n",
 						data->h_a_35->mean, data->h_p_35->mean,
 						data->h_a_22->mean, data->h_p_22->mean,
@@ -1113,14 +1477,15 @@ void *start_slow_loop_calibrate(void *args)
 						data->v_a_22->mean, data->v_p_22->mean,
 						case_temp, board_temp, accel1, accel2, reset_count);
 */
-			fprintf(loop_file,
+			fprintf(loop_file.file,
  			"% 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7.1f; % 7d; % 7d; % 7d\n",
  						data->h_i_35->mean, data->h_q_35->mean,
  						data->h_i_22->mean, data->h_q_22->mean,
  						data->v_i_35->mean, data->v_q_35->mean,
  						data->v_i_22->mean, data->v_q_22->mean,
  						case_temp, board_temp, accel1, accel2, reset_count);
-
+			summarize_loop_record(&loop_file, &tim, data, case_temp, board_temp);
+			data_file_record(&loop_file);
 		}
                 
                 // Print out amplitudes every second
@@ -1166,7 +1531,7 @@ void *start_slow_loop_calibrate(void *args)
 
 	syslog(LOG_NOTICE, "Slow low stopped\n");
 
-	fclose(loop_file);
+	data_file_close(&loop_file);
 	free_data_struct(data);
 	free(pcBufRead);
 
@@ -1191,23 +1556,20 @@ int set_case_temp(FT_HANDLE ftHandle,int t)
 	return 0;
 }
 
-int get_case_temp(FT_HANDLE ftHandle)
+int get_case_temp(FT_HANDLE ftHandle, double *temp)
 {
-	int t_msb, t_lsb;
 	char c_t_msb, c_t_lsb;
-	double case_temp = 0;
+	int status;
 
 	syslog(LOG_NOTICE, "Get case temperature\n");
 
-	write_byte(ftHandle, GET_CASE_TEMP);
-	
-//	t_lsb = (int)read_byte(ftHandle);
-//	t_msb = (int)read_byte(ftHandle);
+	status = write_byte(ftHandle, GET_CASE_TEMP);
+	if (status != OK)			return status;
 
-	read_byte(ftHandle, &c_t_lsb);
-	read_byte(ftHandle, &c_t_msb);
-	t_lsb = (int)c_t_lsb;
-	t_msb = (int)c_t_msb;
+	status = read_byte(ftHandle, &c_t_lsb);
+	if (status != OK)			return status;
+	status = read_byte(ftHandle, &c_t_msb);
+	if (status != OK)			return status;
 		
 	//!! CHANGE THIS!!!!!
 	// MSB has range of -55 to 125 --> see DS1621 datasheet
@@ -1216,12 +1578,11 @@ int get_case_temp(FT_HANDLE ftHandle)
 	// Should work because signed char (c_t_msb) is casted to int (t_msb),
 	// which is already the right case temperatures msb. t_lsb indicastes only 
 	// a 0.5 addition.
-	case_temp = t_msb - 0.5 * t_lsb/128;
+	*temp = (int)c_t_msb - 0.5 * (int)c_t_lsb/128;
 
-	syslog(LOG_NOTICE, "Case temperature %.1f \n", t_msb - 0.5 * t_lsb/128);
-	syslog (LOG_NOTICE, "Case temperature = %.1f \n", case_temp);
+	syslog(LOG_NOTICE, "Case temperature = %.1f \n", *temp);
 	
-	return 0;
+	return OK;
 }
 
 int set_board_temp(FT_HANDLE ftHandle,int t)
@@ -1241,23 +1602,20 @@ int set_board_temp(FT_HANDLE ftHandle,int t)
 	return 0;
 }
 
-int get_board_temp(FT_HANDLE ftHandle)
+int get_board_temp(FT_HANDLE ftHandle, double *temp)
 {
-	int t_msb, t_lsb;
 	char c_t_msb, c_t_lsb;
-	double case_temp = 0;
+	int status;
 
 	syslog(LOG_NOTICE, "Get board temperature\n");
 
-	write_byte(ftHandle, GET_BOARD_TEMP);
-	
-//	t_lsb = (int)read_byte(ftHandle);
-//	t_msb = (int)read_byte(ftHandle);
+	status = write_byte(ftHandle, GET_BOARD_TEMP);
+	if (status != OK)			return status;
 
-	read_byte(ftHandle, &c_t_lsb);
-	read_byte(ftHandle, &c_t_msb);
-	t_lsb = (int)c_t_lsb;
-	t_msb = (int)c_t_msb;
+	status = read_byte(ftHandle, &c_t_lsb);
+	if (status != OK)			return status;
+	status = read_byte(ftHandle, &c_t_msb);
+	if (status != OK)			return status;
 		
 	//!! CHANGE THIS!!!!!
 	// MSB has range of -55 to 125 --> see DS1621 datasheet
@@ -1266,10 +1624,9 @@ int get_board_temp(FT_HANDLE ftHandle)
 	// Should work because signed char (c_t_msb) is casted to int (t_msb),
 	// which is already the right case temperatures msb. t_lsb indicastes only 
 	// a 0.5 addition.
-	case_temp = t_msb - 0.5 * t_lsb/128;
+	*temp = (int)c_t_msb - 0.5 * (int)c_t_lsb/128;
 
-	syslog(LOG_NOTICE, "Board temperature %.1f \n", t_msb - 0.5 * t_lsb/128);
-	syslog (LOG_NOTICE, "Board temperature = %.1f \n", case_temp);
+	syslog(LOG_NOTICE, "Board temperature = %.1f \n", *temp);
 	
 	return OK;
 }
@@ -1289,21 +1646,24 @@ int set_loop_freq(FT_HANDLE ftHandle, int f)
 	return OK;
 }
 
-int get_lock(FT_HANDLE ftHandle)
+int get_lock(FT_HANDLE ftHandle, int *lock)
 {
 	unsigned char value, uC_status;
 	int status;	
 	
 	syslog(LOG_NOTICE, "Get lock indicators\n");
 	
-	write_byte(ftHandle, GET_LOCK);
+	status = write_byte(ftHandle, GET_LOCK);
+	if (status != OK)			return status;
 	
-	read_byte(ftHandle, &value);
+	status = read_byte(ftHandle, (char *)&value);
+	if (status != OK)			return status;
 	
 	syslog(LOG_NOTICE, "Lock indicators: %d\n", (int)value);
+	*lock = value;
 	
 	// Wait for done message
-	status = read_byte(ftHandle, &uC_status);
+	status = read_byte(ftHandle, (char *)&uC_status);
 	if (status != OK)  			return status;
 	if (uC_status != DONE)		return uC_ERR;
 	
@@ -1312,104 +1672,52 @@ int get_lock(FT_HANDLE ftHandle)
 	
 
 
-int get_adc4(FT_HANDLE ftHandle)
+// Read one of the ADC inputs of the uC and convert it to volts
+static int get_adc(FT_HANDLE ftHandle, char cmd, int n, double *adc_value)
 {
 	unsigned char c_msb, c_lsb, uC_status;
-	double adc_value = 0;
 	int status;
 	
-	syslog(LOG_NOTICE, "Get adc4 value\n");
+	syslog(LOG_NOTICE, "Get adc%d value\n", n);
 
-	write_byte(ftHandle, GET_ADC4);
+	status = write_byte(ftHandle, cmd);
+	if (status != OK)			return status;
 	
-	read_byte(ftHandle, &c_lsb);
-	read_byte(ftHandle, &c_msb);
+	status = read_byte(ftHandle, (char *)&c_lsb);
+	if (status != OK)			return status;
+	status = read_byte(ftHandle, (char *)&c_msb);
+	if (status != OK)			return status;
 		
-	adc_value = ((double)c_msb*256 + (double)c_lsb) * V_REF/1024;
+	*adc_value = ((double)c_msb*256 + (double)c_lsb) * V_REF/1024;
 	
-	syslog(LOG_NOTICE, "ADC4 %.4f \n", adc_value);
+	syslog(LOG_NOTICE, "ADC%d %.4f \n", n, *adc_value);
 	
 	// Wait for done message
-	status = read_byte(ftHandle, &uC_status);
+	status = read_byte(ftHandle, (char *)&uC_status);
 	if (status != OK)  			return status;
 	if (uC_status != DONE)		return uC_ERR;
 	
 	return OK;
 }
 
-int get_adc5(FT_HANDLE ftHandle)
+int get_adc4(FT_HANDLE ftHandle, double *value)
 {
-	unsigned char c_msb, c_lsb, uC_status;
-	double adc_value = 0;
-	int status;
-	
-	syslog(LOG_NOTICE, "Get adc5 value\n");
-
-	write_byte(ftHandle, GET_ADC5);
-	
-	read_byte(ftHandle, &c_lsb);
-	read_byte(ftHandle, &c_msb);
-		
-	adc_value = ((double)c_msb*256 + (double)c_lsb) * V_REF/1024;
-	
-	syslog(LOG_NOTICE, "ADC5 %.4f \n", adc_value);
-	
-	// Wait for done message
-	status = read_byte(ftHandle, &uC_status);
-	if (status != OK)  			return status;
-	if (uC_status != DONE)		return uC_ERR;
-	
-	return OK;
+	return get_adc(ftHandle, GET_ADC4, 4, value);
 }
 
-int get_adc6(FT_HANDLE ftHandle)
+int get_adc5(FT_HANDLE ftHandle, double *value)
 {
-	unsigned char c_msb, c_lsb, uC_status;
-	double adc_value = 0;
-	int status;
-	
-	syslog(LOG_NOTICE, "Get adc6 value\n");
-
-	write_byte(ftHandle, GET_ADC6);
-	
-	read_byte(ftHandle, &c_lsb);
-	read_byte(ftHandle, &c_msb);
-		
-	adc_value = ((double)c_msb*256 + (double)c_lsb) * V_REF/1024;
-	
-	syslog(LOG_NOTICE, "ADC6 %.4f \n", adc_value);
-	
-	// Wait for done message
-	status = read_byte(ftHandle, &uC_status);
-	if (status != OK)  			return status;
-	if (uC_status != DONE)		return uC_ERR;
-	
-	return OK;
+	return get_adc(ftHandle, GET_ADC5, 5, value);
 }
 
-int get_adc7(FT_HANDLE ftHandle)
+int get_adc6(FT_HANDLE ftHandle, double *value)
 {
-	unsigned char c_msb, c_lsb, uC_status;
-	double adc_value = 0;
-	int status;
-	
-	syslog(LOG_NOTICE, "Get adc7 value\n");
+	return get_adc(ftHandle, GET_ADC6, 6, value);
+}
 
-	write_byte(ftHandle, GET_ADC7);
-	
-	read_byte(ftHandle, &c_lsb);
-	read_byte(ftHandle, &c_msb);
-		
-	adc_value = ((double)c_msb*256 + (double)c_lsb) * V_REF/1024;
-	
-	syslog(LOG_NOTICE, "ADC7 %.4f \n", adc_value);
-	
-	// Wait for done message
-	status = read_byte(ftHandle, &uC_status);
-	if (status != OK)  			return status;
-	if (uC_status != DONE)		return uC_ERR;
-	
-	return OK;
+int get_adc7(FT_HANDLE ftHandle, double *value)
+{
+	return get_adc(ftHandle, GET_ADC7, 7, value);
 }
 
 int set_reset_count(FT_HANDLE ftHandle)
@@ -1421,21 +1729,21 @@ int set_reset_count(FT_HANDLE ftHandle)
 	return 0;
 }
 
-int get_reset_count(FT_HANDLE ftHandle)
+int get_reset_count(FT_HANDLE ftHandle, int *reset_count)
 {
-	int reset_count = 0;
 	char c_reset_count;
+	int status;
 	
 	syslog(LOG_NOTICE, "Get reset count\n");
-	write_byte(ftHandle, GET_RESET_COUNT);
-//	reset_count = (int)read_byte(ftHandle);
-	read_byte(ftHandle, &c_reset_count);
-	reset_count = (int)c_reset_count;
+	status = write_byte(ftHandle, GET_RESET_COUNT);
+	if (status != OK)			return status;
+	status = read_byte(ftHandle, &c_reset_count);
+	if (status != OK)			return status;
+	*reset_count = (unsigned char)c_reset_count;
 
-	syslog(LOG_NOTICE, "%d resets\n\n", reset_count);
-	syslog (LOG_NOTICE, "Resets = %d \n", reset_count);
+	syslog (LOG_NOTICE, "Resets = %d \n", *reset_count);
 	
-	return 0;
+	return OK;
 }
 
 int get_device_list_info()
@@ -1715,95 +2023,6 @@ unsigned int bytes_to_int(char *chars)
 	return value;
 }
 
-// Allocate memory for data struct and return its pointer
-DATA_STRUCT *create_data_struct(int N)
-{
-	DATA_STRUCT *data = malloc(sizeof *data);
-	//data = (DATA_STRUCT*) malloc(sizeof (DATA_STRUCT)); // above one is better
-	//DATA_POINTS *p = malloc(sizeof *p);
-	//data->h_i_22 = p;
-	data->h_i_22 = malloc(sizeof *(data->h_i_22));
-	data->h_q_22 = malloc(sizeof *(data->h_q_22));
-	data->h_i_35 = malloc(sizeof *(data->h_i_35));
-	data->h_q_35 = malloc(sizeof *(data->h_q_35));
-	data->v_i_22 = malloc(sizeof *(data->v_i_22));
-	data->v_q_22 = malloc(sizeof *(data->v_q_22));
-	data->v_i_35 = malloc(sizeof *(data->v_i_35));
-	data->v_q_35 = malloc(sizeof *(data->v_q_35));
-
-	data->h_a_22 = malloc(sizeof *(data->h_a_22));
-	data->h_p_22 = malloc(sizeof *(data->h_p_22));
-	data->h_a_35 = malloc(sizeof *(data->h_a_35));
-	data->h_p_35 = malloc(sizeof *(data->h_p_35));
-	data->v_a_22 = malloc(sizeof *(data->v_a_22));
-	data->v_p_22 = malloc(sizeof *(data->v_p_22));
-	data->v_a_35 = malloc(sizeof *(data->v_a_35));
-	data->v_p_35 = malloc(sizeof *(data->v_p_35));
-	
-	data->h_i_22->values = malloc(sizeof *(data->h_i_22->values) * N);
-	data->h_q_22->values = malloc(sizeof *(data->h_q_22->values) * N);
-	data->h_i_35->values = malloc(sizeof *(data->h_i_35->values) * N);
-	data->h_q_35->values = malloc(sizeof *(data->h_q_35->values) * N);
-	data->v_i_22->values = malloc(sizeof *(data->v_i_22->values) * N);
-	data->v_q_22->values = malloc(sizeof *(data->v_q_22->values) * N);
-	data->v_i_35->values = malloc(sizeof *(data->v_i_35->values) * N);
-	data->v_q_35->values = malloc(sizeof *(data->v_q_35->values) * N);
-	
-	data->h_a_22->values = malloc(sizeof *(data->h_a_22->values) * N);
-	data->h_p_22->values = malloc(sizeof *(data->h_p_22->values) * N);
-	data->h_a_35->values = malloc(sizeof *(data->h_a_35->values) * N);
-	data->h_p_35->values = malloc(sizeof *(data->h_p_35->values) * N);
-	data->v_a_22->values = malloc(sizeof *(data->v_a_22->values) * N);
-	data->v_p_22->values = malloc(sizeof *(data->v_p_22->values) * N);
-	data->v_a_35->values = malloc(sizeof *(data->v_a_35->values) * N);
-	data->v_p_35->values = malloc(sizeof *(data->v_p_35->values) * N);
-
-	return data;
-}
-
-// Free alocated memory of data struct
-int free_data_struct(DATA_STRUCT *data)
-{
-	free(data->h_i_22->values);
-	free(data->h_q_22->values);
-	free(data->h_i_35->values);
-	free(data->h_q_35->values);
-	free(data->v_i_22->values);
-	free(data->v_q_22->values);
-	free(data->v_i_35->values);
-	free(data->v_q_35->values);
-	free(data->h_i_22);
-	free(data->h_q_22);
-	free(data->h_i_35);
-	free(data->h_q_35);
-	free(data->v_i_22);
-	free(data->v_q_22);
-	free(data->v_i_35);
-	free(data->v_q_35);
-	
-	free(data->h_a_22->values);
-	free(data->h_p_22->values);
-	free(data->h_a_35->values);
-	free(data->h_p_35->values);
-	free(data->v_a_22->values);
-	free(data->v_p_22->values);
-	free(data->v_a_35->values);
-	free(data->v_p_35->values);
-	free(data->h_a_22);
-	free(data->h_p_22);
-	free(data->h_a_35);
-	free(data->h_p_35);
-	free(data->v_a_22);
-	free(data->v_p_22);
-	free(data->v_a_35);
-	free(data->v_p_35);
-	
-	free(data);
-	
-	return OK;
-}
-
-
 /////////////
 // M A I N //
 /////////////
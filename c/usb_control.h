@@ -8,7 +8,12 @@
 // GLOBALS //
 /////////////
 
-int slow_loop_keep_running;
+extern int slow_loop_keep_running;
+
+// Pauses of the running slow loop to serve other requests, in s
+extern long slow_loop_gaps;
+extern double slow_loop_last_gap;
+extern double slow_loop_max_gap;
 
 //////////////
 // COMMANDS //
@@ -30,6 +35,7 @@ int slow_loop_keep_running;
 #define SET_LOOP_FREQ_10	0x21
 #define SET_LOOP_FREQ_20	0x22
 #define GET_LOCK		0xD0
+#define GET_CONFIG		0xC0	// all CPLD settings in one frame
 
 // for CPLD measurements
 #define START_MSRMNT 		0x1E
@@ -110,6 +116,7 @@ struct thread_args{
 	int read_buffer_size;
 	DWORD dwBytesRead;
 	PULSE_CONF *conf;
+	struct rotate_policy *rotation;	// when to start a new slow loop file
 };
 
 
@@ -228,7 +235,7 @@ int set_adc(FT_HANDLE ftHandle, int adc);
 int set_pol_precede(FT_HANDLE ftHandle, int precede);
 
 // Get status from CPLD (lock bits from PLOs)
-int get_status(FT_HANDLE ftHandle);
+int get_status(FT_HANDLE ftHandle, int *value);
 
 // Set attenuatores for 22 GHz system
 int set_atten22(FT_HANDLE ftHandle, int atten1, int atten2);
@@ -236,10 +243,43 @@ int set_atten22(FT_HANDLE ftHandle, int atten1, int atten2);
 // Set attenuatores for 35 GHz system
 int set_atten35(FT_HANDLE ftHandle, int atten1, int atten2);
 
+// Fields of a configuration batch, bit n of the mask is field n
+#define CONF_N_SAMPLES		0
+#define CONF_PW			1
+#define CONF_DELAY		2
+#define CONF_POL_PRECEDE	3
+#define CONF_ADC_DELAY		4
+#define CONF_MODE		5
+#define CONF_ATTEN22		6
+#define CONF_ATTEN35		7
+#define CONF_LOOP_FREQ		8	// not part of PULSE_CONF
+#define CONF_FIELDS		9
+#define CONF_NOT_SENT		0xE4	// result of fields that were not sent
+#define CONF_UNKNOWN		0xE5	// sent, but the reply was lost after a
+					// USB error, the device may have taken it
+
+// Check the fields in mask of a complete configuration, also against
+// each other (delay >= pw+5). Fields not in mask hold the current values.
+int check_pulse_conf(PULSE_CONF *conf, int loop_freq, int mask);
+
+// Send the fields in mask to the device in one transaction: all command
+// bytes are written at once, then the replies are read. results gets the
+// status of every field in mask. Returns OK or the first error.
+int set_pulse_conf(FT_HANDLE ftHandle, PULSE_CONF *conf, int loop_freq,
+		   int mask, int *results);
+
+// Read back the CPLD settings in one frame. valid gets the mask of the
+// fields the device has taken since its last reset, only those are set
+// in conf. Returns uC_ERR if the firmware does not know GET_CONFIG.
+#define CONFIG_FRAME		16	// echo, valid mask, 13 bytes, DONE
+int get_pulse_conf(FT_HANDLE ftHandle, PULSE_CONF *conf, int *valid);
+
 void *FT_Read_thread(void *args);
 		
 //int start_msrmnt(FT_HANDLE ftHandle,int n_samples,struct i_q_h_v_data* data,int* size);
 int start_msrmnt(FT_HANDLE ftHandle,int n_samples,DATA_STRUCT* data);
+int start_msrmnt_buf(FT_HANDLE ftHandle, int n_bytes_to_read, DATA_STRUCT *data,
+		     unsigned char *buf);
 
 void *start_slow_loop(void *args);
 
@@ -249,24 +289,26 @@ void *start_slow_loop_calibrate(void *args);
 
 int set_case_temp(FT_HANDLE ftHandle,int t);
 
-int get_case_temp(FT_HANDLE ftHandle);
+// Temperatures in degree Celsius
+int get_case_temp(FT_HANDLE ftHandle, double *temp);
 
 int set_board_temp(FT_HANDLE ftHandle,int t);
 
-int get_board_temp(FT_HANDLE ftHandle);
+int get_board_temp(FT_HANDLE ftHandle, double *temp);
 
 int set_loop_freq(FT_HANDLE ftHandle, int t);
 
-int get_lock(FT_HANDLE ftHandle);
+int get_lock(FT_HANDLE ftHandle, int *lock);
 
-int get_adc4(FT_HANDLE ftHandle);
-int get_adc5(FT_HANDLE ftHandle);
-int get_adc6(FT_HANDLE ftHandle);
-int get_adc7(FT_HANDLE ftHandle);
+// ADC inputs of the uC in volts
+int get_adc4(FT_HANDLE ftHandle, double *value);
+int get_adc5(FT_HANDLE ftHandle, double *value);
+int get_adc6(FT_HANDLE ftHandle, double *value);
+int get_adc7(FT_HANDLE ftHandle, double *value);
 
 int set_reset_count(FT_HANDLE ftHandle);
 
-int get_reset_count(FT_HANDLE ftHandle);
+int get_reset_count(FT_HANDLE ftHandle, int *reset_count);
 
 int get_device_list_info();
 
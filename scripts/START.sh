@@ -14,11 +14,18 @@ main() {
     cd /root
     nohup ./feed_watchdog_loop.sh > /dev/null 2>&1 &
 
-    ####################################################
-    # Scripts for file transfer and DAQ of disdrometer #
-    ####################################################
-    #nohup ./read_distrometer.sh > /dev/null 2>&1 &
-    nohup ./move_data_to_server.sh > /dev/null 2>&1 &
+    #####################
+    # File transfer     #
+    #####################
+    # needs ./receiver running in data_inbox/attrra on the server. It
+    # only listens on localhost there, the uploader goes through an ssh
+    # tunnel that is opened again whenever it drops.
+    nohup bash -c 'while true; do
+        ssh -N -o ExitOnForwardFailure=yes -o ServerAliveInterval=30 \
+            -L 2222:127.0.0.1:2222 chwala-c@gimpel
+        sleep 10
+    done' > /dev/null 2>&1 &
+    nohup /root/attrrac/uploader localhost > /dev/null 2>&1 &
 
     #######################
     # Select ATTTRA modes #
@@ -27,6 +34,10 @@ main() {
     start_attrra_slow_loop
     #start_burst_read_every_minute
     #start_radar_every_10_sec
+    #start_mixed
+
+    # DAQ of disdrometer, read by attrracd
+    #start_distrometer
 }
 
 
@@ -41,7 +52,6 @@ start_attrra() {
 
 set_attrra_default_config() {
     ./attrrac set_default
-    sleep 1
 }
 
 
@@ -49,44 +59,61 @@ set_attrra_default_config() {
 # Different modes of operation #
 ################################
 
+start_distrometer() {
+    cd /root/attrrac
+    ./attrrac start_distrometer
+}
+
 start_attrra_slow_loop() {
     cd /root/attrrac
 
+    # attrracd.conf holds the configuration (e.g. n_samples=32 pw=20
+    # adc_delay=0 loop_freq=20). The daemon applies it in one
+    # transaction. With "start = slow_loop" in attrracd.conf it starts
+    # measuring by itself and the start below is ignored.
     start_attrra
-    set_attrra_default_config
-
-    ./attrrac set_n_samples 32
-    sleep 1
-    ./attrrac set_pw 20
-    ./attrrac set_adc_delay 0
-    sleep 1
-    ./attrrac set_loop_freq 20
-    sleep 1
     ./attrrac start_slow_loop
 }
 
 start_burst_read_every_minute() {
     cd /root/attrrac
 
+    # "start = slow_loop" must stay out of attrracd.conf in this mode
     start_attrra
     set_attrra_default_config
 
-    ./attrrac set_n_samples 75000
-    sleep 1
-    nohup /root/trigger_burst_read_every_minute.sh > /dev/null 2>&1 &
+    ./attrrac set_config "n_samples=75000"
+    # the daemon starts a burst at every full minute
+    ./attrrac set_schedule start "0 * *"
 }
 
 start_radar_every_10_sec() {
     cd /root/attrrac
 
+    # "start = slow_loop" must stay out of attrracd.conf in this mode
     start_attrra
     set_attrra_default_config
     
-    ./attrrac set_n_samples 512
-    sleep 1
-    nohup /root/trigger_radar_every_10_sec.sh > /dev/null 2>&1 &
+    ./attrrac set_config "n_samples=512"
+    # the daemon starts a radar sweep every 10 s
+    ./attrrac set_schedule radar "*/10 * *"
 }
 
+start_mixed() {
+    cd /root/attrrac
+
+    # slow loop, paused by the daemon for a burst every minute and a
+    # radar sweep every 5 minutes. Each job runs with its own n_samples,
+    # the loop configuration is restored afterwards and the gap is
+    # written to the loop file.
+    start_attrra
+    ./attrrac start_slow_loop
+
+    ./attrrac set_job_config start "n_samples=75000"
+    ./attrrac set_job_config radar "n_samples=512"
+    ./attrrac set_schedule start "0 * *"
+    ./attrrac set_schedule radar "30 */5 *"
+}
 
 # Finally, run the whole script...
 main